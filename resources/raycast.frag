@@ -0,0 +1,159 @@
+#version 330 core
+
+// Renderer::renderFrame() as a fragment shader: every pixel casts the ray of its
+// column and works out whether it is floor, wall or ceiling. The arithmetic follows
+// RaycasterEngine.cpp step by step, so both draw the same image
+
+in vec3 aColor;
+in vec2 uv;
+out vec4 FragColor;
+
+// material of every cell, 0 is empty
+uniform usampler2D map;
+// a layer per atlas tile. The atlas is column-major, so texel (x, y) of a tile is at
+// (y, x) here
+uniform sampler2DArray walls;
+uniform int materialTiles[256];
+uniform int tileShift;
+// mip levels to choose from, 1 without mipmapping
+uniform int levels;
+// pixels of the frame
+uniform ivec2 frameSize;
+uniform vec2 cameraPos;
+uniform float cameraAngle;
+uniform float fov;
+uniform float maxDist;
+
+const uint OUTSIDE_MATERIAL = 1u;
+const float INFINITY = 1e30;
+const vec3 FLOOR_COLOR = vec3(0x55, 0x55, 0x55);
+const vec3 CEILING_COLOR = vec3(0x55, 0x55, 0xff);
+// brightness levels of the fog, FogTable::LEVELS
+const int FOG_LEVELS = 64;
+
+// Map::material()
+uint material(ivec2 cell)
+{
+    ivec2 size = textureSize(map, 0);
+    if (cell.x < 0 || cell.y < 0 || cell.x >= size.x || cell.y >= size.y) return OUTSIDE_MATERIAL;
+    return texelFetch(map, cell, 0).r;
+}
+
+// (a << shift) / b for a < b, exactly. The CPU divides in 64 bits, there are none
+// here, so it is long division a bit at a time; a stays below b < 2^31
+uint shiftedRatio(uint a, uint b, int shift)
+{
+    uint q = 0u;
+    for (int i = 0; i < shift; ++i)
+    {
+        a <<= 1u;
+        q <<= 1u;
+        if (a >= b)
+        {
+            a -= b;
+            q |= 1u;
+        }
+    }
+    return q;
+}
+
+void main()
+{
+    // the pixel of the frame, whatever the size of the viewport
+    int x = min(int(uv.x * float(frameSize.x)), frameSize.x - 1);
+    int y = min(int(uv.y * float(frameSize.y)), frameSize.y - 1);
+    int height = frameSize.y;
+    
+    // Renderer::updateColumnTable() and renderTile()
+    float rayDisplacementAngle = -fov / 2.0 + (1.0 * float(x) / float(frameSize.x)) * fov;
+    vec2 offset = vec2(cos(rayDisplacementAngle), sin(rayDisplacementAngle));
+    vec2 heading = vec2(cos(cameraAngle), sin(cameraAngle));
+    vec2 dir = vec2(heading.x * offset.x - heading.y * offset.y,
+                    heading.y * offset.x + heading.x * offset.y);
+    
+    // castRay()
+    ivec2 cell = ivec2(floor(cameraPos));
+    float dist = 0.0;
+    int side = 0;
+    vec2 deltaDist = vec2(dir.x != 0.0 ? abs(1.0 / dir.x) : INFINITY,
+                          dir.y != 0.0 ? abs(1.0 / dir.y) : INFINITY);
+    ivec2 step = ivec2(dir.x < 0.0 ? -1 : 1, dir.y < 0.0 ? -1 : 1);
+    vec2 sideDist = vec2(dir.x < 0.0 ? cameraPos.x - float(cell.x) : float(cell.x) + 1.0 - cameraPos.x,
+                         dir.y < 0.0 ? cameraPos.y - float(cell.y) : float(cell.y) + 1.0 - cameraPos.y);
+    sideDist.x = dir.x != 0.0 ? sideDist.x * deltaDist.x : INFINITY;
+    sideDist.y = dir.y != 0.0 ? sideDist.y * deltaDist.y : INFINITY;
+    uint hitMaterial;
+    while ((hitMaterial = material(cell)) == 0u)
+    {
+        if (sideDist.x < sideDist.y)
+        {
+            dist = sideDist.x;
+            if (dist >= maxDist) break;
+            sideDist.x += deltaDist.x;
+            cell.x += step.x;
+            side = 0;
+        }
+        else
+        {
+            dist = sideDist.y;
+            if (dist >= maxDist) break;
+            sideDist.y += deltaDist.y;
+            cell.y += step.y;
+            side = 1;
+        }
+    }
+    
+    // hitTextureU()
+    float u;
+    if (side == 0)
+    {
+        u = cameraPos.y + dist * dir.y - float(cell.y);
+        if (dir.x < 0.0) u = 1.0 - u;
+    }
+    else
+    {
+        u = cameraPos.x + dist * dir.x - float(cell.x);
+        if (dir.y > 0.0) u = 1.0 - u;
+    }
+    u = clamp(u, 0.0, 1.0);
+    
+    // Renderer::shadeColumn()
+    float wallDist = min(maxDist, dist);
+    float z = max(wallDist * offset.x, 1e-3);
+    int floorYBorder = int(float(height) / 2.0 - float(height) / z);
+    int ceilingYBorder = height - floorYBorder;
+    int wallBegin = clamp(floorYBorder + 1, 0, height);
+    int wallEnd = clamp(ceilingYBorder, wallBegin, height);
+    if (y < wallBegin)
+    {
+        FragColor = vec4(FLOOR_COLOR / 255.0, 1.0);
+        return;
+    }
+    if (y >= wallEnd)
+    {
+        FragColor = vec4(CEILING_COLOR / 255.0, 1.0);
+        return;
+    }
+    
+    int wallHeight = ceilingYBorder - floorYBorder;
+    int level = 0;
+    while (level + 1 < levels && ((1 << tileShift) >> (level + 1)) >= wallHeight)
+    {
+        ++level;
+    }
+    int texShift = tileShift - level;
+    int size = 1 << texShift;
+    // 16.16 fixed point stepped once per pixel, wrapping the same way
+    uint vStep = (1u << uint(texShift + 16)) / uint(wallHeight);
+    uint v = shiftedRatio(uint(wallBegin - floorYBorder), uint(wallHeight), texShift + 16) + uint(y - wallBegin) * vStep;
+    int texX = min(int(u * float(size)), size - 1);
+    int texY = int(v >> 16u) & (size - 1);
+    vec4 texel = texelFetch(walls, ivec3(texY, texX, materialTiles[hitMaterial]), level);
+    
+    // FogTable: white near us, black when far, darker on y sides
+    float brightness = 1.0 - z / maxDist;
+    int fog = clamp(int(brightness * float(FOG_LEVELS - 1) + 0.5), 0, FOG_LEVELS - 1);
+    float mult = float(fog) / float(FOG_LEVELS - 1) / float(side + 1);
+    vec3 shaded = floor(mult * floor(texel.rgb * 255.0 + 0.5));
+    FragColor = vec4(shaded / 255.0, 1.0);
+}
@@ -5,8 +5,20 @@ in vec2 uv;
 out vec4 FragColor;
 
 uniform sampler2D ourTexture;
+// With indexed set ourTexture holds palette indices (GL_R8) and the colors are in
+// palette, a 256x1 texture
+uniform bool indexed;
+uniform sampler2D palette;
 
 void main()
 {
-    FragColor = texture(ourTexture, uv);
+    if (indexed)
+    {
+        int index = int(texture(ourTexture, uv).r * 255.0 + 0.5);
+        FragColor = texelFetch(palette, ivec2(index, 0), 0);
+    }
+    else
+    {
+        FragColor = texture(ourTexture, uv);
+    }
 }
\ No newline at end of file
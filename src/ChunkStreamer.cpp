@@ -0,0 +1,249 @@
+#include "ChunkStreamer.h"
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <utility>
+
+#include "spdlog/spdlog.h"
+#include "MapFile.h"
+
+namespace raycaster
+{
+    static const size_t OCCUPANCY_BYTES = Map::CHUNK_SIZE * sizeof(uint64_t);
+    
+    ChunkStreamer::ChunkStreamer(size_t budget)
+    : m_budget(budget),
+    m_viewDistance(256.f),
+    m_frame(0),
+    m_stats(),
+    m_latencySum(0.),
+    m_latencyCount(0),
+    m_stop(false)
+    {}
+    
+    ChunkStreamer::~ChunkStreamer()
+    {
+        if (m_thread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_cv.notify_all();
+            m_thread.join();
+        }
+    }
+    
+    bool ChunkStreamer::open(const char *file)
+    {
+        assert(!isOpen());
+        std::unique_ptr<Map> map = MapFile::load(file);
+        if (!map) return false;
+        
+        // Rays must not fault pages of the file in, so nothing they read may stay in
+        // it: chunks with walls start as walls, the pyramid is copied and the distance
+        // field, as big as the map, is left out
+        size_t chunkCount = map->m_occupancyChunks.size();
+        m_fileOccupancy.assign(chunkCount, nullptr);
+        m_fileMaterials.assign(chunkCount, nullptr);
+        m_chunks.resize(chunkCount);
+        for (size_t i = 0; i < chunkCount; ++i)
+        {
+            m_chunks[i].lastSeen = 0;
+            m_chunks[i].queued = false;
+            m_chunks[i].missed = false;
+            if (map->isChunkEmpty(i)) continue;
+            m_fileOccupancy[i] = map->m_occupancyChunks[i];
+            m_fileMaterials[i] = map->m_materialChunks[i];
+            map->m_occupancyChunks[i] = Map::opaqueOccupancyChunk();
+            map->m_materialChunks[i] = Map::opaqueMaterialChunk();
+        }
+        for (int level = 1; level <= Map::BLOCK_LEVELS; ++level)
+        {
+            const BitPlane &file = map->m_blocks[level - 1];
+            BitPlane copy(file.width(), file.height());
+            memcpy(copy.words(), file.words(), BitPlane::wordsNeeded(file.width(), file.height()) * sizeof(uint64_t));
+            map->m_blocks[level - 1] = std::move(copy);
+        }
+        map->m_distances = nullptr;
+        
+        m_map = std::move(map);
+        m_thread = std::thread(&ChunkStreamer::readLoop, this);
+        return true;
+    }
+    
+    void ChunkStreamer::update(const Camera &camera)
+    {
+        assert(isOpen());
+        ++m_frame;
+        m_changed.clear();
+        size_t room = m_budget / CHUNK_BYTES;
+        std::vector<size_t> visible;
+        predict(camera, visible);
+        
+        std::vector<LoadedChunk> loaded;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            loaded.swap(m_loaded);
+            // requests the thread didn't get to are made again below if still needed
+            for (size_t index : m_requests)
+            {
+                m_chunks[index].queued = false;
+            }
+            m_requests.clear();
+            
+            // as many of the nearest chunks as the budget holds are asked for, the
+            // rest are counted as missed and wait until the camera comes closer
+            for (size_t i = 0; i < visible.size() && i < room; ++i)
+            {
+                Chunk &chunk = m_chunks[visible[i]];
+                if (!chunk.data && !chunk.queued)
+                {
+                    chunk.queued = true;
+                    m_requests.push_back(visible[i]);
+                }
+            }
+        }
+        m_cv.notify_one();
+        
+        auto now = std::chrono::steady_clock::now();
+        for (LoadedChunk &chunk : loaded)
+        {
+            m_chunks[chunk.index].queued = false;
+            install(chunk.index, std::move(chunk.data));
+        }
+        for (size_t index : visible)
+        {
+            Chunk &chunk = m_chunks[index];
+            chunk.lastSeen = m_frame;
+            if (chunk.data)
+            {
+                ++m_stats.hits;
+                if (chunk.missed)
+                {
+                    double latency = std::chrono::duration<double, std::milli>(now - chunk.missedSince).count();
+                    m_latencySum += latency;
+                    ++m_latencyCount;
+                    m_stats.maxLatency = std::max(m_stats.maxLatency, latency);
+                    chunk.missed = false;
+                }
+            }
+            else
+            {
+                ++m_stats.misses;
+                if (!chunk.missed)
+                {
+                    chunk.missed = true;
+                    chunk.missedSince = now;
+                }
+            }
+        }
+        
+        // least recently seen first out, nothing that is in view now
+        if (m_resident.size() > room)
+        {
+            std::sort(m_resident.begin(), m_resident.end(), [this](size_t a, size_t b)
+            {
+                return m_chunks[a].lastSeen < m_chunks[b].lastSeen;
+            });
+            size_t drop = 0;
+            while (m_resident.size() - drop > room && m_chunks[m_resident[drop]].lastSeen != m_frame)
+            {
+                evict(m_resident[drop++]);
+            }
+            m_resident.erase(m_resident.begin(), m_resident.begin() + drop);
+        }
+        
+        m_stats.averageLatency = m_latencyCount ? m_latencySum / m_latencyCount : 0.;
+        m_stats.residentChunks = m_resident.size();
+        m_stats.residentBytes = m_resident.size() * CHUNK_BYTES;
+    }
+    
+    void ChunkStreamer::predict(const Camera &camera, std::vector<size_t> &visible) const
+    {
+        // A chunk is wanted if it is around the camera, so turning finds it there, or
+        // if it is closer than the view distance and its bounding circle gets into the
+        // field of view
+        const float half = Map::CHUNK_SIZE * 0.5f;
+        const float radius = half * (float)M_SQRT2;
+        int x0 = std::max((int)floorf((camera.pos.x - m_viewDistance) / Map::CHUNK_SIZE), 0);
+        int y0 = std::max((int)floorf((camera.pos.y - m_viewDistance) / Map::CHUNK_SIZE), 0);
+        int x1 = std::min((int)floorf((camera.pos.x + m_viewDistance) / Map::CHUNK_SIZE), m_map->m_chunksX - 1);
+        int y1 = std::min((int)floorf((camera.pos.y + m_viewDistance) / Map::CHUNK_SIZE), m_map->m_chunksY - 1);
+        
+        std::vector<std::pair<float, size_t>> found;
+        for (int cy = y0; cy <= y1; ++cy)
+        {
+            for (int cx = x0; cx <= x1; ++cx)
+            {
+                size_t index = (size_t)cy * m_map->m_chunksX + cx;
+                if (!m_fileOccupancy[index]) continue;
+                float dx = cx * Map::CHUNK_SIZE + half - camera.pos.x;
+                float dy = cy * Map::CHUNK_SIZE + half - camera.pos.y;
+                float dist = sqrtf(dx*dx + dy*dy);
+                if (dist - radius > m_viewDistance) continue;
+                if (dist > radius + Map::CHUNK_SIZE)
+                {
+                    float off = fabsf(remainderf(atan2f(dy, dx) - camera.angle, 2.f * (float)M_PI));
+                    if (off > camera.fov * 0.5f + asinf(radius / dist)) continue;
+                }
+                found.push_back(std::make_pair(dist, index));
+            }
+        }
+        std::sort(found.begin(), found.end());
+        visible.resize(found.size());
+        for (size_t i = 0; i < found.size(); ++i)
+        {
+            visible[i] = found[i].second;
+        }
+    }
+    
+    void ChunkStreamer::install(size_t index, std::unique_ptr<unsigned char[]> data)
+    {
+        Chunk &chunk = m_chunks[index];
+        if (chunk.data) return;
+        chunk.data = std::move(data);
+        m_map->m_occupancyChunks[index] = (uint64_t*)chunk.data.get();
+        m_map->m_materialChunks[index] = chunk.data.get() + OCCUPANCY_BYTES;
+        // edits made while the chunk was in before are gone from the cells, the
+        // pyramid must forget them too
+        int x = (int)(index % m_map->m_chunksX) << Map::CHUNK_SHIFT, y = (int)(index / m_map->m_chunksX) << Map::CHUNK_SHIFT;
+        m_map->rebuildBlocks(x, y, std::min(x + (int)Map::CHUNK_SIZE, m_map->width()), std::min(y + (int)Map::CHUNK_SIZE, m_map->height()));
+        m_resident.push_back(index);
+        m_changed.push_back(index);
+        ++m_stats.loads;
+    }
+    
+    void ChunkStreamer::evict(size_t index)
+    {
+        Chunk &chunk = m_chunks[index];
+        m_map->m_occupancyChunks[index] = Map::opaqueOccupancyChunk();
+        m_map->m_materialChunks[index] = Map::opaqueMaterialChunk();
+        chunk.data.reset();
+        m_changed.push_back(index);
+        ++m_stats.evictions;
+    }
+    
+    void ChunkStreamer::readLoop()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            m_cv.wait(lock, [this] { return m_stop || !m_requests.empty(); });
+            if (m_stop) return;
+            size_t index = m_requests.front();
+            m_requests.pop_front();
+            lock.unlock();
+            
+            // the copy is where the pages come from disk, on this thread
+            std::unique_ptr<unsigned char[]> data(new unsigned char[CHUNK_BYTES]);
+            memcpy(data.get(), m_fileOccupancy[index], OCCUPANCY_BYTES);
+            memcpy(data.get() + OCCUPANCY_BYTES, m_fileMaterials[index], CHUNK_BYTES - OCCUPANCY_BYTES);
+            
+            lock.lock();
+            m_loaded.push_back(LoadedChunk{index, std::move(data)});
+        }
+    }
+}
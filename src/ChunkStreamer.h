@@ -0,0 +1,135 @@
+#ifndef CHUNK_STREAMER_H
+#define CHUNK_STREAMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Map.h"
+#include "RaycasterEngine.h"
+
+namespace raycaster
+{
+    struct StreamStats
+    {
+        // chunks in view that were in memory and that weren't, and were drawn as walls
+        uint64_t hits, misses;
+        uint64_t loads, evictions;
+        // from the first frame a chunk was missed to the frame it could be drawn, ms
+        double averageLatency, maxLatency;
+        size_t residentChunks, residentBytes;
+    };
+    
+    // Keeps only the chunks of a map file around the viewer in memory, for worlds that
+    // don't fit in it. Every frame update() guesses what the camera will see, asks a
+    // background thread to read the chunks that are missing and drops the least
+    // recently seen ones over the memory budget. Rays never wait for the disk: a chunk
+    // that isn't in yet is a block of walls until it is.
+    // The map touches no file memory while rendering. Its distance field isn't used,
+    // edits to a chunk are lost when it is dropped and cells of missing chunks can't be
+    // edited at all
+    class ChunkStreamer
+    {
+    public:
+        const static size_t DEFAULT_BUDGET = 256 << 20;
+        const static size_t CHUNK_BYTES = Map::CHUNK_SIZE * sizeof(uint64_t) + Map::CHUNK_SIZE * Map::CHUNK_SIZE;
+    
+    private:
+        struct Chunk
+        {
+            // occupancy then materials, nullptr if the chunk isn't in memory
+            std::unique_ptr<unsigned char[]> data;
+            // frame the chunk was in view last time
+            unsigned lastSeen;
+            // given to the reading thread and not back yet
+            bool queued;
+            bool missed;
+            std::chrono::steady_clock::time_point missedSince;
+        };
+        struct LoadedChunk
+        {
+            size_t index;
+            std::unique_ptr<unsigned char[]> data;
+        };
+        
+        std::unique_ptr<Map> m_map;
+        // where every chunk is in the file, nullptr for chunks without walls. Read
+        // by the reading thread too, never changed after open()
+        std::vector<const uint64_t*> m_fileOccupancy;
+        std::vector<const unsigned char*> m_fileMaterials;
+        std::vector<Chunk> m_chunks;
+        std::vector<size_t> m_resident;
+        // put in or dropped by the last update()
+        std::vector<size_t> m_changed;
+        size_t m_budget;
+        float m_viewDistance;
+        unsigned m_frame;
+        StreamStats m_stats;
+        double m_latencySum;
+        uint64_t m_latencyCount;
+        
+        // shared with the reading thread
+        std::thread m_thread;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::deque<size_t> m_requests;
+        std::vector<LoadedChunk> m_loaded;
+        bool m_stop;
+    
+    public:
+        // budget is the memory chunks may take, in bytes
+        explicit ChunkStreamer(size_t budget = DEFAULT_BUDGET);
+        ChunkStreamer(const ChunkStreamer&) = delete;
+        ~ChunkStreamer();
+        
+        // false if the file can't be loaded, see MapFile::load()
+        bool open(const char *file);
+        
+        inline bool isOpen() const
+        {
+            return m_map != nullptr;
+        }
+        inline Map& map()
+        {
+            return *m_map;
+        }
+        inline const Map& map() const
+        {
+            return *m_map;
+        }
+        inline const StreamStats& stats() const
+        {
+            return m_stats;
+        }
+        // chunks put in the map or dropped from it by the last update(), so their
+        // cells changed
+        inline const std::vector<size_t>& changedChunks() const
+        {
+            return m_changed;
+        }
+        // how far ahead of the camera chunks are fetched, in cells
+        inline void setViewDistance(float cells)
+        {
+            m_viewDistance = cells;
+        }
+        
+        // call between frames, with no rendering going on: puts the chunks read since
+        // the last call in the map, drops the old ones and requests what camera needs
+        void update(const Camera &camera);
+    
+    private:
+        // chunks with walls the camera may see, the nearest first
+        void predict(const Camera &camera, std::vector<size_t> &visible) const;
+        void install(size_t index, std::unique_ptr<unsigned char[]> data);
+        void evict(size_t index);
+        void readLoop();
+    };
+}
+
+#endif
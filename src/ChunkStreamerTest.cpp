@@ -0,0 +1,73 @@
+// Checks that an edit to a streamed chunk is forgotten by the whole map when the
+// chunk is dropped and read again: the cells come back from the file and the block
+// pyramid the hierarchical traversal skips by must agree with them. Exits with 1
+// if not. Writes ChunkStreamerTest.rcmp in the working directory and removes it
+#include <stdio.h>
+#include <chrono>
+#include <thread>
+
+#include "spdlog/spdlog.h"
+#include "ChunkStreamer.h"
+#include "MapFile.h"
+#include "RaycasterEngine.h"
+
+auto console = spdlog::stdout_color_st("console");
+
+const char *MAP_FILE = "ChunkStreamerTest.rcmp";
+// a row of four chunks, the middle two empty so they are never streamed
+const int MAP_WIDTH = 4 * raycaster::Map::CHUNK_SIZE;
+const int MAP_HEIGHT = raycaster::Map::CHUNK_SIZE;
+// the reading thread gets this long to bring a chunk in
+const int WAIT_MS = 5000;
+
+// update the streamer from camera until the cell, empty in the file, is empty in the
+// map (its chunk is in) or a wall (it is out) as asked
+static bool waitFor(raycaster::ChunkStreamer &streamer, const raycaster::Camera &camera, int x, int y, bool resident)
+{
+    for (int i = 0; i < WAIT_MS; ++i)
+    {
+        streamer.update(camera);
+        if (streamer.map().isWall(x, y) != resident) return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    console->error("Chunk of cell {0},{1} didn't get {2}", x, y, resident ? "in" : "out");
+    return false;
+}
+
+static bool test()
+{
+    raycaster::Map file(MAP_WIDTH, MAP_HEIGHT, raycaster::Map::CHUNKED);
+    file.setWall(10, 10, true);
+    file.setWall(MAP_WIDTH - 6, 10, true);
+    if (!raycaster::MapFile::save(file, MAP_FILE)) return false;
+    
+    // room for one chunk, so going to the other end drops the first one
+    raycaster::ChunkStreamer streamer(raycaster::ChunkStreamer::CHUNK_BYTES);
+    if (!streamer.open(MAP_FILE)) return false;
+    streamer.setViewDistance(8.f);
+    raycaster::Map &map = streamer.map();
+    raycaster::Camera home(raycaster::vec2<float>(20.5f, 20.5f), 0.f, 1.f);
+    raycaster::Camera away(raycaster::vec2<float>(MAP_WIDTH - 20.5f, 20.5f), 0.f, 1.f);
+    
+    if (!waitFor(streamer, home, 12, 12, true)) return false;
+    if (!map.setCell(10, 10, raycaster::Map::EMPTY)) return false;
+    if (!waitFor(streamer, away, 12, 12, false)) return false;
+    if (!waitFor(streamer, home, 12, 12, true)) return false;
+    
+    // looking up at the wall from below, it is back
+    raycaster::vec2<float> pos(10.5f, 20.5f), up(0.f, -1.f);
+    raycaster::RayHit dda = raycaster::castRay(map, pos, up, 32.f);
+    raycaster::RayHit hierarchical = raycaster::castRayHierarchical(map, pos, up, 32.f);
+    console->info("Wall 10,10: {0}, DDA stops at {1},{2}, hierarchical at {3},{4}", map.isWall(10, 10),
+                  dda.cell.x, dda.cell.y, hierarchical.cell.x, hierarchical.cell.y);
+    return map.isWall(10, 10) && dda.cell.x == 10 && dda.cell.y == 10 &&
+           hierarchical.cell.x == 10 && hierarchical.cell.y == 10;
+}
+
+int main()
+{
+    bool passed = test();
+    remove(MAP_FILE);
+    console->info("Edit, evict and reload: {0}", passed ? "passed" : "FAILED");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,124 @@
+#include "FrameScheduler.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <thread>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+namespace core
+{
+    // spinning is kept between these, whatever sleeps do
+    static const std::chrono::microseconds MIN_SPIN(200), MAX_SPIN(4000);
+    
+    FrameScheduler::FrameScheduler(Pacing pacing, double targetFps)
+    : m_frameStart(Clock::now()),
+    m_spin(std::chrono::microseconds(1000)),
+    m_nextFrame(0)
+    {
+#ifdef _WIN32
+        // the default timer tick is 15.6 ms, sleeps of a frame would be useless
+        timeBeginPeriod(1);
+#endif
+        setPacing(pacing, targetFps);
+    }
+    
+    FrameScheduler::~FrameScheduler()
+    {
+#ifdef _WIN32
+        timeEndPeriod(1);
+#endif
+    }
+    
+    void FrameScheduler::setPacing(Pacing pacing, double targetFps)
+    {
+        m_pacing = pacing;
+        if (pacing == PACING_TARGET_FPS)
+        {
+            assert(targetFps > 0.);
+            m_period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1. / targetFps));
+        }
+        m_deadline = Clock::now();
+    }
+    
+    void FrameScheduler::sleepUntil(Clock::time_point deadline)
+    {
+        Clock::time_point now = Clock::now();
+        if (deadline - now > m_spin)
+        {
+            Clock::time_point wake = deadline - m_spin;
+            std::this_thread::sleep_until(wake);
+            // learn from the oversleep: spin a bit more than the worst one lately, and
+            // let that go down slowly while sleeps are on time
+            Clock::duration late = Clock::now() - wake;
+            m_spin = std::max(m_spin - m_spin / 64, late + late / 4);
+            m_spin = std::min(std::max(m_spin, Clock::duration(MIN_SPIN)), Clock::duration(MAX_SPIN));
+        }
+        while (Clock::now() < deadline)
+        {
+            std::this_thread::yield();
+        }
+    }
+    
+    double FrameScheduler::beginFrame()
+    {
+        if (m_pacing == PACING_TARGET_FPS)
+        {
+            m_deadline += m_period;
+            Clock::time_point now = Clock::now();
+            if (now - m_deadline > m_period)
+            {
+                // more than a frame behind (a hitch, a window drag): start over from
+                // now instead of rushing frames to catch up
+                m_deadline = now;
+            }
+            else
+            {
+                sleepUntil(m_deadline);
+            }
+        }
+        
+        Clock::time_point start = Clock::now();
+        double dt = std::chrono::duration<double>(start - m_frameStart).count();
+        m_frameStart = start;
+        if ((int)m_frameTimes.size() < HISTORY)
+        {
+            m_frameTimes.push_back(dt * 1000.);
+        }
+        else
+        {
+            m_frameTimes[m_nextFrame] = dt * 1000.;
+        }
+        m_nextFrame = (m_nextFrame + 1) % HISTORY;
+        return dt;
+    }
+    
+    FrameStats FrameScheduler::stats() const
+    {
+        FrameStats stats = { 0, 0., 0., 0., 0., 0. };
+        if (m_frameTimes.empty()) return stats;
+        
+        std::vector<double> sorted(m_frameTimes);
+        std::sort(sorted.begin(), sorted.end());
+        // nearest rank
+        auto percentile = [&sorted](int p) -> double
+        {
+            size_t rank = (sorted.size() * p + 99) / 100;
+            return sorted[std::max(rank, (size_t)1) - 1];
+        };
+        stats.frames = (int)sorted.size();
+        for (double t : sorted)
+        {
+            stats.average += t;
+        }
+        stats.average /= sorted.size();
+        stats.p50 = percentile(50);
+        stats.p95 = percentile(95);
+        stats.p99 = percentile(99);
+        stats.worst = sorted.back();
+        return stats;
+    }
+}
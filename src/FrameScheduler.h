@@ -0,0 +1,75 @@
+#ifndef FRAME_SCHEDULER_H
+#define FRAME_SCHEDULER_H
+
+#include <chrono>
+#include <vector>
+
+namespace core
+{
+    // frame times over the last FrameScheduler::HISTORY frames, ms
+    struct FrameStats
+    {
+        int frames;
+        double average, p50, p95, p99, worst;
+    };
+    
+    // Decides when the next frame starts and keeps track of how regular frames are.
+    // With a target rate every frame has a deadline on the steady clock, a period
+    // after the previous one, so late frames don't push the ones after them back.
+    // The wait sleeps while the deadline is far and spins the last bit, because a
+    // sleep may wake up a millisecond or more late; how much to spin is learned
+    // from how late sleeps have been
+    class FrameScheduler
+    {
+    public:
+        typedef std::chrono::steady_clock Clock;
+        
+        enum Pacing
+        {
+            // the swap waits for the display, nothing is waited for here
+            PACING_VSYNC,
+            // as fast as it goes, no waiting at all
+            PACING_UNCAPPED,
+            // frames start every 1 / target seconds, the swap doesn't wait
+            PACING_TARGET_FPS
+        };
+        
+        const static int HISTORY = 240;
+    
+    private:
+        Pacing m_pacing;
+        Clock::duration m_period;
+        Clock::time_point m_deadline, m_frameStart;
+        // spin this long before the deadline instead of sleeping
+        Clock::duration m_spin;
+        // start to start times of the last frames, a ring, ms
+        std::vector<double> m_frameTimes;
+        int m_nextFrame;
+        
+        void sleepUntil(Clock::time_point deadline);
+    
+    public:
+        FrameScheduler(Pacing pacing = PACING_VSYNC, double targetFps = 60.);
+        FrameScheduler(const FrameScheduler&) = delete;
+        ~FrameScheduler();
+        
+        void setPacing(Pacing pacing, double targetFps = 60.);
+        inline Pacing pacing() const
+        {
+            return m_pacing;
+        }
+        // the swap interval the window should use with this pacing
+        inline int swapInterval() const
+        {
+            return m_pacing == PACING_VSYNC ? 1 : 0;
+        }
+        
+        // call at the start of every frame: waits for the frame's deadline if there is
+        // one and returns the seconds since the previous frame started
+        double beginFrame();
+        // percentiles of the frame times, sorted out of the history when asked
+        FrameStats stats() const;
+    };
+}
+
+#endif
@@ -0,0 +1,206 @@
+#include "GpuRenderer.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+
+namespace raycaster
+{
+    GpuRenderer::GpuRenderer(const char *vertexShader, const char *fragmentShader)
+    : m_shader(vertexShader, fragmentShader),
+    m_mapTex(0),
+    m_wallTex(0),
+    m_mapWidth(0),
+    m_mapHeight(0),
+    m_tileShift(0),
+    m_levels(0),
+    m_mipmapping(true),
+    m_maxDist(16.f),
+    m_fbo(0),
+    m_fboTex(0),
+    m_fboWidth(0),
+    m_fboHeight(0)
+    {
+        std::fill(m_materialTiles, m_materialTiles + 256, 0);
+    }
+    
+    GpuRenderer::~GpuRenderer()
+    {
+        dispose();
+    }
+    
+    void GpuRenderer::dispose()
+    {
+        GLuint textures[] = { m_mapTex, m_wallTex, m_fboTex };
+        glDeleteTextures(3, textures);
+        m_mapTex = m_wallTex = m_fboTex = 0;
+        m_mapWidth = m_mapHeight = 0;
+        if (m_fbo != 0)
+        {
+            glDeleteFramebuffers(1, &m_fbo);
+            m_fbo = 0;
+        }
+        if (m_shader.ID != 0)
+        {
+            glDeleteProgram(m_shader.ID);
+            m_shader.ID = 0;
+        }
+    }
+    
+    void GpuRenderer::setWallTextures(const core::TextureAtlas &atlas)
+    {
+        assert(atlas.tileCount() > 0);
+        m_tileShift = atlas.tileShift();
+        m_levels = atlas.levels();
+        if (m_wallTex == 0)
+        {
+            glGenTextures(1, &m_wallTex);
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, m_wallTex);
+        // texels are fetched by the shader, filtering never happens
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, m_levels - 1);
+        for (int level = 0; level < m_levels; ++level)
+        {
+            int size = atlas.tileSize() >> level;
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, size, size, atlas.tileCount(), 0,
+                         GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, nullptr);
+            // levels of a tile aren't next to the same level of the next tile
+            for (int i = 0; i < atlas.tileCount(); ++i)
+            {
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, i, size, size, 1,
+                                GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, atlas.tile(i, level));
+            }
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+    
+    bool GpuRenderer::uploadMap(const Map &map)
+    {
+        GLint maxSize = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+        if (map.width() > maxSize || map.height() > maxSize)
+        {
+            spdlog::get("console")->error("Map of {0}x{1} doesn't fit in a texture, {2} is the most", map.width(), map.height(), maxSize);
+            return false;
+        }
+        
+        if (m_mapTex == 0 || map.width() != m_mapWidth || map.height() != m_mapHeight)
+        {
+            // immutable storage can't be resized, a new size gets a new texture
+            glDeleteTextures(1, &m_mapTex);
+            m_mapWidth = m_mapHeight = 0;
+            glGenTextures(1, &m_mapTex);
+            glBindTexture(GL_TEXTURE_2D, m_mapTex);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+            // errors of earlier calls would be taken for the allocation's
+            while (glGetError() != GL_NO_ERROR) {}
+            if (GLAD_GL_ARB_texture_storage)
+            {
+                glTexStorage2D(GL_TEXTURE_2D, 1, GL_R8UI, map.width(), map.height());
+            }
+            else
+            {
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_R8UI, map.width(), map.height(), 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+            }
+            glBindTexture(GL_TEXTURE_2D, 0);
+            GLenum error = glGetError();
+            if (error != GL_NO_ERROR)
+            {
+                spdlog::get("console")->error("Texture for a {0}x{1} map can't be allocated, GL error {2:#x}", map.width(), map.height(), error);
+                glDeleteTextures(1, &m_mapTex);
+                m_mapTex = 0;
+                return false;
+            }
+            m_mapWidth = map.width();
+            m_mapHeight = map.height();
+        }
+        // a band of rows at a time, so the copy stays small for big maps
+        for (int y = 0; y < map.height(); y += Map::CHUNK_SIZE)
+        {
+            updateMap(map, 0, y, map.width(), Map::CHUNK_SIZE);
+        }
+        return true;
+    }
+    
+    void GpuRenderer::updateMap(const Map &map, int x, int y, int width, int height)
+    {
+        assert(m_mapTex != 0 && map.width() == m_mapWidth && map.height() == m_mapHeight);
+        width = std::min(width, map.width() - x);
+        height = std::min(height, map.height() - y);
+        if (width <= 0 || height <= 0) return;
+        
+        std::vector<unsigned char> materials((size_t)width * height);
+        for (int j = 0; j < height; ++j)
+        {
+            for (int i = 0; i < width; ++i)
+            {
+                materials[(size_t)j * width + i] = map.material(x + i, y + j);
+            }
+        }
+        glBindTexture(GL_TEXTURE_2D, m_mapTex);
+        // rows of bytes aren't padded
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, GL_RED_INTEGER, GL_UNSIGNED_BYTE, materials.data());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    
+    void GpuRenderer::render(const Camera &camera, int width, int height, core::ImageRenderer &renderer)
+    {
+        assert(m_mapTex != 0 && m_wallTex != 0);
+        m_shader.use();
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, m_mapTex);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, m_wallTex);
+        glActiveTexture(GL_TEXTURE0);
+        m_shader.setInt("map", 0);
+        m_shader.setInt("walls", 1);
+        glUniform1iv(glGetUniformLocation(m_shader.ID, "materialTiles"), 256, m_materialTiles);
+        m_shader.setInt("tileShift", m_tileShift);
+        m_shader.setInt("levels", m_mipmapping ? m_levels : 1);
+        glUniform2i(glGetUniformLocation(m_shader.ID, "frameSize"), width, height);
+        m_shader.setVec2("cameraPos", camera.pos.x, camera.pos.y);
+        m_shader.setFloat("cameraAngle", camera.angle);
+        m_shader.setFloat("fov", camera.fov);
+        m_shader.setFloat("maxDist", m_maxDist);
+        renderer.render(&m_shader);
+    }
+    
+    void GpuRenderer::renderOffscreen(const Camera &camera, core::ImageRenderer &renderer, FrameBuffer &frame)
+    {
+        assert(frame.layout() == FrameBuffer::ROW_MAJOR);
+        if (frame.width() != m_fboWidth || frame.height() != m_fboHeight)
+        {
+            if (m_fbo == 0)
+            {
+                glGenFramebuffers(1, &m_fbo);
+                glGenTextures(1, &m_fboTex);
+            }
+            glBindTexture(GL_TEXTURE_2D, m_fboTex);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, frame.width(), frame.height(), 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, nullptr);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_fboTex, 0);
+            assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+            m_fboWidth = frame.width();
+            m_fboHeight = frame.height();
+        }
+        
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+        glViewport(0, 0, frame.width(), frame.height());
+        render(camera, frame.width(), frame.height(), renderer);
+        // row 0 is at the bottom in both
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glReadPixels(0, 0, frame.width(), frame.height(), GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, &frame.pixel(0, 0));
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef GPU_RENDERER_H
+#define GPU_RENDERER_H
+
+#include "glad/glad.h"
+#include "learnopengl/shader.h"
+#include "ImageRenderer.h"
+#include "Map.h"
+#include "RaycasterEngine.h"
+#include "TextureAtlas.h"
+
+namespace raycaster
+{
+    // Draws what Renderer does, but the rays are cast by a fragment shader: every
+    // pixel traces its column's ray through the map, kept on the GPU as a texture of
+    // materials, and picks floor, ceiling or a texel of the wall. The walls are a
+    // texture array with a layer per atlas tile and the camera comes in as uniforms,
+    // so a frame costs one quad and nothing is uploaded per frame.
+    // The image matches Renderer's up to the last bits of the GPU's sin and cos. Needs
+    // a current GL 3.3 context for its whole life
+    class GpuRenderer
+    {
+    private:
+        Shader m_shader;
+        // material of every cell (R8UI) and the wall tiles (RGBA8 array)
+        GLuint m_mapTex, m_wallTex;
+        // size m_mapTex was allocated for
+        int m_mapWidth, m_mapHeight;
+        int m_tileShift, m_levels;
+        int m_materialTiles[256];
+        bool m_mipmapping;
+        float m_maxDist;
+        // target of renderOffscreen(), made for the size asked the last time
+        GLuint m_fbo, m_fboTex;
+        int m_fboWidth, m_fboHeight;
+        
+    public:
+        GpuRenderer(const char *vertexShader, const char *fragmentShader);
+        GpuRenderer(const GpuRenderer&) = delete;
+        ~GpuRenderer();
+        void dispose();
+        
+        // upload the tiles of the atlas with their mip levels. Every material shows
+        // tile 0 until told otherwise
+        void setWallTextures(const core::TextureAtlas &atlas);
+        inline void setMaterialTexture(unsigned char material, int tile)
+        {
+            m_materialTiles[material] = tile;
+        }
+        // same as Renderer's, on by default
+        inline void setMipmapping(bool mipmapping)
+        {
+            m_mipmapping = mipmapping;
+        }
+        inline void setMaxDistance(float dist)
+        {
+            m_maxDist = dist;
+        }
+        // upload the materials of every cell. The texture is allocated only the first
+        // time or when the size changed, so this can be called again after big changes.
+        // False if the map is larger than the biggest texture the driver takes or the
+        // texture can't be allocated
+        bool uploadMap(const Map &map);
+        // upload the cells of [x; x + width) x [y; y + height) again after they changed,
+        // clipped to the map. uploadMap() must have succeeded with a map of that size
+        void updateMap(const Map &map, int x, int y, int width, int height);
+        inline void updateMapChunk(const Map &map, size_t chunk)
+        {
+            updateMap(map, (int)(chunk % map.chunksX()) << Map::CHUNK_SHIFT, (int)(chunk / map.chunksX()) << Map::CHUNK_SHIFT,
+                      Map::CHUNK_SIZE, Map::CHUNK_SIZE);
+        }
+        
+        // draw a frame of width x height pixels over the current viewport, with the
+        // quad of renderer
+        void render(const Camera &camera, int width, int height, core::ImageRenderer &renderer);
+        // draw the frame into an offscreen framebuffer and read it into a row-major
+        // frame, to check it against Renderer's
+        void renderOffscreen(const Camera &camera, core::ImageRenderer &renderer, FrameBuffer &frame);
+    };
+}
+
+#endif
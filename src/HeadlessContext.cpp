@@ -0,0 +1,97 @@
+#include "HeadlessContext.h"
+
+#include "glad/glad.h"
+#include "spdlog/spdlog.h"
+#ifdef RAYCASTER_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+namespace core
+{
+    HeadlessContext::HeadlessContext()
+    : m_display(nullptr),
+    m_context(nullptr)
+    {
+    }
+    
+    HeadlessContext::~HeadlessContext()
+    {
+        dispose();
+    }
+
+#ifdef RAYCASTER_EGL
+    bool HeadlessContext::create()
+    {
+        auto console = spdlog::get("console");
+        // the surfaceless platform needs no X or Wayland, the default display may
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        EGLDisplay display = getPlatformDisplay ? getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr)
+                                                : eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        EGLint major, minor;
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+        {
+            console->error("EGL display can't be initialized: {0:x}", eglGetError());
+            return false;
+        }
+        m_display = display;
+        
+        const EGLint contextAttributes[] =
+        {
+            EGL_CONTEXT_MAJOR_VERSION, 3,
+            EGL_CONTEXT_MINOR_VERSION, 3,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        EGLContext context = EGL_NO_CONTEXT;
+        if (eglBindAPI(EGL_OPENGL_API))
+        {
+            context = eglCreateContext(display, (EGLConfig)0, EGL_NO_CONTEXT, contextAttributes);
+        }
+        if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+        {
+            console->error("EGL context can't be created: {0:x}", eglGetError());
+            if (context != EGL_NO_CONTEXT) eglDestroyContext(display, context);
+            dispose();
+            return false;
+        }
+        m_context = context;
+        
+        if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+        {
+            console->error("OpenGL functions can't be loaded");
+            dispose();
+            return false;
+        }
+        console->info("Headless EGL {0}.{1} context: {2}, {3}", major, minor,
+                      (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION));
+        return true;
+    }
+    
+    void HeadlessContext::dispose()
+    {
+        if (m_context)
+        {
+            eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            eglDestroyContext(m_display, m_context);
+            m_context = nullptr;
+        }
+        if (m_display)
+        {
+            eglTerminate(m_display);
+            m_display = nullptr;
+        }
+    }
+#else
+    bool HeadlessContext::create()
+    {
+        spdlog::get("console")->error("Built without RAYCASTER_EGL, there is no headless context");
+        return false;
+    }
+    
+    void HeadlessContext::dispose()
+    {
+    }
+#endif
+}
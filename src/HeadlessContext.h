@@ -0,0 +1,29 @@
+#ifndef HEADLESS_CONTEXT_H
+#define HEADLESS_CONTEXT_H
+
+namespace core
+{
+    // OpenGL 3.3 core context without a window or a display server, made through
+    // EGL's surfaceless platform. Mesa's llvmpipe provides one on any machine, so the
+    // GL paths can be run and checked where there is no GPU. There is no default
+    // framebuffer, draw into framebuffer objects.
+    // Only built with RAYCASTER_EGL (the RAYCASTER_HEADLESS CMake option), create()
+    // fails otherwise
+    class HeadlessContext
+    {
+    private:
+        void *m_display;
+        void *m_context;
+    
+    public:
+        HeadlessContext();
+        HeadlessContext(const HeadlessContext&) = delete;
+        ~HeadlessContext();
+        
+        // make the context current and load GL functions. false if that's impossible
+        bool create();
+        void dispose();
+    };
+}
+
+#endif
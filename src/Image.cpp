@@ -0,0 +1,55 @@
+#include "Image.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include "spdlog/spdlog.h"
+namespace core
+{
+    ImageBase::ImageBase()
+    : m_width(0),
+    m_height(0),
+    m_data(nullptr)
+    {}
+    
+    Image::Image()
+    : ImageBase()
+    {}
+    Image::~Image()
+    {
+        dispose();
+    }
+    bool Image::loadFromFile(const char *file)
+    {
+        assert(m_data == nullptr);
+        int channels;
+        unsigned char *pixels = stbi_load(file, &m_width, &m_height, &channels, 4);
+        if (pixels == nullptr)
+        {
+            spdlog::get("console")->error("Image \"{0}\" can't be loaded: {1}", file, stbi_failure_reason());
+            m_width = m_height = 0;
+            return false;
+        }
+        
+        m_data = new Pixel[m_width*m_height];
+        for (int y = 0; y < m_height; ++y)
+        {
+            for (int x = 0; x < m_width; ++x)
+            {
+                const unsigned char *rgba = pixels + (y*m_width + x)*4;
+                pixel(x, y) = packPixel(rgba[0], rgba[1], rgba[2], rgba[3]);
+            }
+        }
+        stbi_image_free(pixels);
+        spdlog::get("console")->info("Image \"{0}\" {1}x{2}x{3} loaded successfully", file, m_width, m_height, channels);
+        return true;
+    }
+    void Image::dispose()
+    {
+        if (m_data)
+        {
+            delete[] m_data;
+            m_width = m_height = 0;
+            m_data = nullptr;
+        }
+    }
+}
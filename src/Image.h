@@ -0,0 +1,81 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <assert.h>
+#include <stdint.h>
+
+namespace core
+{
+    // Every image keeps its pixels packed as 0xAARRGGBB in one 32 bit word. That is
+    // GL_BGRA with GL_UNSIGNED_INT_8_8_8_8_REV for OpenGL, so it takes them as is
+    typedef uint32_t Pixel;
+    
+    inline Pixel packPixel(unsigned r, unsigned g, unsigned b, unsigned a = 0xff)
+    {
+        return (a << 24) | (r << 16) | (g << 8) | b;
+    }
+    inline unsigned pixelRed(Pixel p)
+    {
+        return (p >> 16) & 0xff;
+    }
+    inline unsigned pixelGreen(Pixel p)
+    {
+        return (p >> 8) & 0xff;
+    }
+    inline unsigned pixelBlue(Pixel p)
+    {
+        return p & 0xff;
+    }
+    inline unsigned pixelAlpha(Pixel p)
+    {
+        return p >> 24;
+    }
+    
+    class ImageBase
+    {
+    protected:
+        int m_width, m_height;
+        Pixel *m_data;
+        
+    public:
+        ImageBase();
+        virtual ~ImageBase() {}
+        virtual void dispose()=0;
+        
+        inline Pixel& pixel(int x, int y)
+        {
+            return m_data[y*m_width + x];
+        }
+        inline const Pixel& pixel(int x, int y) const
+        {
+            return m_data[y*m_width + x];
+        }
+        inline Pixel* data()
+        {
+            return m_data;
+        }
+        inline int width() const
+        {
+            return m_width;
+        }
+        inline int height() const
+        {
+            return m_height;
+        }
+        
+    };
+    
+    class Image : public ImageBase
+    {
+    public:
+        Image();
+        ~Image();
+        
+        // the conversion to packed pixels is done here, once. False (and an empty
+        // image) when the file can't be read or decoded
+        bool loadFromFile(const char *file);
+        void dispose();
+    };
+}
+
+#endif
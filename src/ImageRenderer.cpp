@@ -52,6 +52,10 @@ namespace core
     void ImageRenderer::render(Texture *tex, Shader *shader)
     {
         tex->bindTexture();
+        render(shader);
+    }
+    void ImageRenderer::render(Shader *shader)
+    {
         shader->use();
         glClearColor(0.0,0.0,0.0,1.0);
         glClear(GL_COLOR_BUFFER_BIT);
@@ -18,6 +18,8 @@ namespace core
         
         void dispose();
         void render(Texture *tex, Shader *shader);
+        // draw the quad with whatever textures the shader needs already bound
+        void render(Shader *shader);
     };
 }
 
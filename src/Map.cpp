@@ -0,0 +1,296 @@
+#include "Map.h"
+
+#include <algorithm>
+
+#include "spdlog/spdlog.h"
+
+namespace raycaster
+{
+    // spread the low 16 bits of v apart: bit i goes to bit 2*i
+    static uint32_t spreadBits(uint32_t v)
+    {
+        v &= 0xffff;
+        v = (v | (v << 8)) & 0x00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    }
+    
+    BitPlane::BitPlane(int width, int height)
+    : m_width(width),
+    m_height(height),
+    m_wordsPerRow((width + 63) / 64),
+    m_storage(wordsNeeded(width, height), 0)
+    {
+        m_words = m_storage.data();
+    }
+    
+    BitPlane::BitPlane(int width, int height, uint64_t *words)
+    : m_width(width),
+    m_height(height),
+    m_wordsPerRow((width + 63) / 64),
+    m_words(words)
+    {
+    }
+    
+    uint64_t* Map::emptyOccupancyChunk()
+    {
+        static uint64_t chunk[CHUNK_SIZE];
+        return chunk;
+    }
+    
+    unsigned char* Map::emptyMaterialChunk()
+    {
+        static unsigned char chunk[CHUNK_SIZE * CHUNK_SIZE];
+        return chunk;
+    }
+    
+    uint64_t* Map::opaqueOccupancyChunk()
+    {
+        static std::vector<uint64_t> chunk(CHUNK_SIZE, ~(uint64_t)0);
+        return chunk.data();
+    }
+    
+    unsigned char* Map::opaqueMaterialChunk()
+    {
+        static std::vector<unsigned char> chunk(CHUNK_SIZE * CHUNK_SIZE, (unsigned char)OUTSIDE_MATERIAL);
+        return chunk.data();
+    }
+    
+    Map::Map()
+    : m_width(0),
+    m_height(0),
+    m_layout(CHUNKED),
+    m_wordsPerRow(0),
+    m_chunksX(0),
+    m_chunksY(0),
+    m_distances(nullptr)
+    {
+    }
+    
+    Map::Map(int width, int height, Layout layout)
+    : m_width(width),
+    m_height(height),
+    m_layout(layout),
+    m_wordsPerRow((width + 63) / 64),
+    m_chunksX((width + CHUNK_SIZE - 1) >> CHUNK_SHIFT),
+    m_chunksY((height + CHUNK_SIZE - 1) >> CHUNK_SHIFT),
+    m_distances(nullptr)
+    {
+        assert(0 < width && width <= MAX_SIZE);
+        assert(0 < height && height <= MAX_SIZE);
+        
+        // the map is empty, only blocks sticking out of it are occupied
+        for (int level = 1; level <= BLOCK_LEVELS; ++level)
+        {
+            int size = 1 << (level * BLOCK_SHIFT);
+            BitPlane &blocks = m_blocks[level - 1];
+            blocks = BitPlane((width + size - 1) / size, (height + size - 1) / size);
+            for (int by = 0; width % size && by < blocks.height(); ++by)
+            {
+                blocks.set(blocks.width() - 1, by, true);
+            }
+            for (int bx = 0; height % size && bx < blocks.width(); ++bx)
+            {
+                blocks.set(bx, blocks.height() - 1, true);
+            }
+        }
+        
+        if (layout == CHUNKED)
+        {
+            m_occupancyChunks.assign((size_t)m_chunksX * m_chunksY, emptyOccupancyChunk());
+            m_materialChunks.assign((size_t)m_chunksX * m_chunksY, emptyMaterialChunk());
+            return;
+        }
+        m_materials.assign((size_t)width * height, (unsigned char)EMPTY);
+        if (layout == ROW_MAJOR)
+        {
+            m_occupancy.assign((size_t)m_wordsPerRow * height, 0);
+            return;
+        }
+        
+        int tilesX = (width + TILE_SIZE - 1) >> TILE_SHIFT;
+        int tilesY = (height + TILE_SIZE - 1) >> TILE_SHIFT;
+        // interleave as many low bits as the shorter side needs, the rest of the longer
+        // side goes on top. A long narrow map becomes a row of Morton squares instead of
+        // one mostly empty square
+        int bits = 0;
+        while ((1 << bits) < std::min(tilesX, tilesY)) ++bits;
+        uint32_t low = (1u << bits) - 1;
+        m_mortonX.resize(tilesX);
+        for (int tx = 0; tx < tilesX; ++tx)
+        {
+            m_mortonX[tx] = spreadBits(tx & low) | ((tx & ~low) << bits);
+        }
+        m_mortonY.resize(tilesY);
+        for (int ty = 0; ty < tilesY; ++ty)
+        {
+            m_mortonY[ty] = (spreadBits(ty & low) << 1) | ((ty & ~low) << bits);
+        }
+        m_occupancy.assign((size_t)m_mortonX[tilesX - 1] + m_mortonY[tilesY - 1] + 1, 0);
+    }
+    
+    Map::~Map()
+    {
+    }
+    
+    void Map::touchChunk(int x, int y)
+    {
+        size_t chunk = chunkIndex(x, y);
+        if (!isChunkEmpty(chunk)) return;
+        m_ownedOccupancy.emplace_back(new uint64_t[CHUNK_SIZE]());
+        m_ownedMaterials.emplace_back(new unsigned char[CHUNK_SIZE * CHUNK_SIZE]());
+        m_occupancyChunks[chunk] = m_ownedOccupancy.back().get();
+        m_materialChunks[chunk] = m_ownedMaterials.back().get();
+    }
+    
+    bool Map::scanBlock(int level, int bx, int by) const
+    {
+        int n = 1 << BLOCK_SHIFT;
+        int x0 = bx << BLOCK_SHIFT, y0 = by << BLOCK_SHIFT;
+        for (int j = 0; j < n; ++j)
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                if (level == 1 ? isWall(x0 + i, y0 + j) : isBlockOccupied(level - 1, x0 + i, y0 + j)) return true;
+            }
+        }
+        return false;
+    }
+    
+    void Map::rebuildBlocks(int x0, int y0, int x1, int y1)
+    {
+        // bottom up, every level reads the one below
+        for (int level = 1; level <= BLOCK_LEVELS; ++level)
+        {
+            int shift = level * BLOCK_SHIFT;
+            for (int by = y0 >> shift; by <= (y1 - 1) >> shift; ++by)
+            {
+                for (int bx = x0 >> shift; bx <= (x1 - 1) >> shift; ++bx)
+                {
+                    m_blocks[level - 1].set(bx, by, scanBlock(level, bx, by));
+                }
+            }
+        }
+    }
+    
+    bool Map::setCell(int x, int y, unsigned char material)
+    {
+        assert(contains(x, y));
+        if (m_layout == CHUNKED)
+        {
+            // a chunk that isn't streamed in has nowhere to keep the edit
+            if (m_occupancyChunks[chunkIndex(x, y)] == opaqueOccupancyChunk())
+            {
+                spdlog::get("console")->warn("Map: cell {0},{1} is in a chunk that isn't loaded, edit dropped", x, y);
+                return false;
+            }
+            // an empty chunk stays shared until a wall goes there
+            if (material == EMPTY && isChunkEmpty(chunkIndex(x, y))) return true;
+            touchChunk(x, y);
+            m_materialChunks[chunkIndex(x, y)][(y & (CHUNK_SIZE - 1))*CHUNK_SIZE + (x & (CHUNK_SIZE - 1))] = material;
+        }
+        else
+        {
+            m_materials[(size_t)y*m_width + x] = material;
+        }
+        
+        bool wall = material != EMPTY;
+        if (isWall(x, y) == wall) return true;
+        uint64_t &word = m_layout == CHUNKED ? m_occupancyChunks[chunkIndex(x, y)][y & (CHUNK_SIZE - 1)]
+                                             : m_occupancy[wordIndex(x, y)];
+        uint64_t bit = (uint64_t)1 << bitIndex(x, y);
+        if (wall) word |= bit;
+        else word &= ~bit;
+        
+        // a wall occupies every block it is in. A removed one frees a block only if
+        // nothing else is in it, which is checked one level below
+        for (int level = 1; level <= BLOCK_LEVELS; ++level)
+        {
+            int shift = level * BLOCK_SHIFT;
+            int bx = x >> shift, by = y >> shift;
+            bool occupied = wall || scanBlock(level, bx, by);
+            if (isBlockOccupied(level, bx, by) == occupied) break;
+            m_blocks[level - 1].set(bx, by, occupied);
+        }
+        
+        if (hasDistanceField())
+        {
+            // only distances up to the cap away can change. Their nearest walls are up to
+            // the cap further, so recompute twice as much and keep the middle
+            int x0 = std::max(x - 2 * DISTANCE_CAP, 0), x1 = std::min(x + 2 * DISTANCE_CAP + 1, m_width);
+            int y0 = std::max(y - 2 * DISTANCE_CAP, 0), y1 = std::min(y + 2 * DISTANCE_CAP + 1, m_height);
+            std::vector<unsigned char> window((size_t)(x1 - x0) * (y1 - y0));
+            distanceTransform(x0, y0, x1, y1, window.data());
+            for (int j = std::max(y - DISTANCE_CAP, 0); j < std::min(y + DISTANCE_CAP + 1, m_height); ++j)
+            {
+                int i0 = std::max(x - DISTANCE_CAP, 0), i1 = std::min(x + DISTANCE_CAP + 1, m_width);
+                std::copy(&window[(size_t)(j - y0) * (x1 - x0) + (i0 - x0)],
+                          &window[(size_t)(j - y0) * (x1 - x0) + (i1 - x0)],
+                          &m_distances[(size_t)j * m_width + i0]);
+            }
+        }
+        return true;
+    }
+    
+    void Map::buildDistanceField()
+    {
+        m_distanceStorage.resize((size_t)m_width * m_height);
+        m_distances = m_distanceStorage.data();
+        distanceTransform(0, 0, m_width, m_height, m_distances);
+    }
+    
+    void Map::distanceTransform(int x0, int y0, int x1, int y1, unsigned char *out) const
+    {
+        int w = x1 - x0, h = y1 - y0;
+        // Two passes of the 3x3 chamfer with all weights 1, which is exact for Chebyshev
+        // distance: first from the neighbours above and to the left, then from below and
+        // to the right. Rows are worked on in buffers with a cell of margin on each side,
+        // so the inner loops need no checks. The outside of the map is a wall, the rest
+        // outside the rectangle is as far as it gets
+        const int FAR = DISTANCE_CAP;
+        unsigned char left = x0 > 0 ? FAR : 0, right = x1 < m_width ? FAR : 0;
+        std::vector<unsigned char> buffer(2 * (w + 2));
+        // the row done before this one, above it in the first pass and below in the second
+        unsigned char *above = &buffer[0], *row = &buffer[w + 2];
+        
+        std::fill(above, above + w + 2, y0 > 0 ? FAR : 0);
+        for (int j = 0; j < h; ++j)
+        {
+            row[0] = left;
+            for (int i = 0; i < w; ++i)
+            {
+                int d = isWall(x0 + i, y0 + j) ? 0 : FAR;
+                d = std::min(d, above[i] + 1);
+                d = std::min(d, above[i + 1] + 1);
+                d = std::min(d, above[i + 2] + 1);
+                d = std::min(d, row[i] + 1);
+                row[i + 1] = (unsigned char)d;
+            }
+            row[w + 1] = right;
+            std::copy(row + 1, row + w + 1, out + (size_t)j * w);
+            std::swap(above, row);
+        }
+        
+        std::fill(above, above + w + 2, y1 < m_height ? FAR : 0);
+        for (int j = h - 1; j >= 0; --j)
+        {
+            unsigned char *dst = out + (size_t)j * w;
+            std::copy(dst, dst + w, row + 1);
+            row[0] = left;
+            row[w + 1] = right;
+            for (int i = w - 1; i >= 0; --i)
+            {
+                int d = row[i + 1];
+                d = std::min(d, above[i] + 1);
+                d = std::min(d, above[i + 1] + 1);
+                d = std::min(d, above[i + 2] + 1);
+                d = std::min(d, row[i + 2] + 1);
+                row[i + 1] = (unsigned char)d;
+            }
+            std::copy(row + 1, row + w + 1, dst);
+            std::swap(above, row);
+        }
+    }
+}
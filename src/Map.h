@@ -0,0 +1,276 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+namespace core
+{
+    class MappedFile;
+}
+
+namespace raycaster
+{
+    // Plane of bits, row by row, 64 per word. Rows are padded to whole words.
+    // Everything outside reads as set. The words are its own or someone else's memory
+    class BitPlane
+    {
+    private:
+        int m_width, m_height;
+        int m_wordsPerRow;
+        uint64_t *m_words;
+        std::vector<uint64_t> m_storage;
+    
+    public:
+        BitPlane(int width = 0, int height = 0);
+        // view of wordsNeeded() words that must outlive the plane
+        BitPlane(int width, int height, uint64_t *words);
+        BitPlane(const BitPlane&) = delete;
+        BitPlane(BitPlane&&) = default;
+        BitPlane& operator=(BitPlane&&) = default;
+        
+        static inline size_t wordsNeeded(int width, int height)
+        {
+            return (size_t)((width + 63) / 64) * height;
+        }
+        
+        inline int width() const
+        {
+            return m_width;
+        }
+        inline int height() const
+        {
+            return m_height;
+        }
+        inline uint64_t* words()
+        {
+            return m_words;
+        }
+        inline const uint64_t* words() const
+        {
+            return m_words;
+        }
+        inline bool get(int x, int y) const
+        {
+            if ((unsigned)x >= (unsigned)m_width || (unsigned)y >= (unsigned)m_height) return true;
+            return (m_words[(size_t)y*m_wordsPerRow + (x >> 6)] >> (x & 63)) & 1;
+        }
+        inline void set(int x, int y, bool value)
+        {
+            uint64_t &word = m_words[(size_t)y*m_wordsPerRow + (x >> 6)];
+            uint64_t bit = (uint64_t)1 << (x & 63);
+            if (value) word |= bit;
+            else word &= ~bit;
+        }
+    };
+    
+    // Grid of cells with runtime dimensions. Whether a cell is a wall is kept in its own
+    // plane of bits, 64 cells per word, so tracing touches as little memory as possible.
+    // What the wall is made of lives in a separate plane, a byte per cell, read only
+    // for the cells rays actually hit.
+    // Everything outside the map is a wall, so levels don't need a closed border
+    class Map
+    {
+        friend class MapFile;
+        friend class ChunkStreamer;
+    
+    public:
+        // how cells are packed into occupancy words.
+        // ROW_MAJOR: a word holds 64 cells of a row, rows are padded to whole words.
+        // TILED: a word holds a TILE_SIZE x TILE_SIZE tile and tiles go in Morton (Z)
+        // order, so cells close to each other in any direction are close in memory.
+        // CHUNKED: the map is cut in CHUNK_SIZE x CHUNK_SIZE chunks found through a table,
+        // with a word per row of a chunk. Chunks without walls all share one chunk of
+        // zeros, so open space costs nothing, and a map file can be used in place
+        enum Layout
+        {
+            ROW_MAJOR,
+            TILED,
+            CHUNKED
+        };
+        
+        const static int MAX_SIZE = 65536;
+        const static int TILE_SHIFT = 3;
+        const static int TILE_SIZE = 1 << TILE_SHIFT;
+        const static int CHUNK_SHIFT = 6;
+        const static int CHUNK_SIZE = 1 << CHUNK_SHIFT;
+        // material 0 is an empty cell
+        const static unsigned char EMPTY = 0;
+        // material reported for cells outside the map
+        const static unsigned char OUTSIDE_MATERIAL = 1;
+        // Besides the cells there is a pyramid of blocks: level 1 has a bit per 4x4 cells,
+        // level 2 per 16x16 and so on. The bit is set if the block has a wall in it or
+        // reaches out of the map, so a ray can fly through a clear block in one step
+        const static int BLOCK_LEVELS = 3;
+        const static int BLOCK_SHIFT = 2;
+        // The optional distance field holds, for every cell, the Chebyshev distance to the
+        // nearest wall (the outside counts) up to this cap: every cell closer than that is
+        // empty. Editing a cell recomputes the field in a window twice the cap around it
+        const static int DISTANCE_CAP = 32;
+    
+    private:
+        int m_width, m_height;
+        Layout m_layout;
+        // ROW_MAJOR: words in a row of the occupancy plane
+        int m_wordsPerRow;
+        // TILED: word of tile (tx, ty) is m_mortonX[tx] + m_mortonY[ty]
+        std::vector<uint32_t> m_mortonX, m_mortonY;
+        // ROW_MAJOR and TILED planes. Materials go row by row
+        std::vector<uint64_t> m_occupancy;
+        std::vector<unsigned char> m_materials;
+        // CHUNKED: chunks row by row, materials of a chunk row by row too. Chunks the map
+        // allocated itself are kept in the owned lists, the rest are the shared empty
+        // chunk or the file's memory
+        int m_chunksX, m_chunksY;
+        std::vector<uint64_t*> m_occupancyChunks;
+        std::vector<unsigned char*> m_materialChunks;
+        std::vector<std::unique_ptr<uint64_t[]>> m_ownedOccupancy;
+        std::vector<std::unique_ptr<unsigned char[]>> m_ownedMaterials;
+        // level l is m_blocks[l - 1]
+        BitPlane m_blocks[BLOCK_LEVELS];
+        // row by row, nullptr if there is no field
+        unsigned char *m_distances;
+        std::vector<unsigned char> m_distanceStorage;
+        // file the map lives in, if it was loaded from one
+        std::shared_ptr<core::MappedFile> m_file;
+        
+        inline size_t wordIndex(int x, int y) const
+        {
+            if (m_layout == TILED) return m_mortonX[x >> TILE_SHIFT] + m_mortonY[y >> TILE_SHIFT];
+            return (size_t)y*m_wordsPerRow + (x >> 6);
+        }
+        inline int bitIndex(int x, int y) const
+        {
+            if (m_layout == TILED) return ((y & (TILE_SIZE - 1)) << TILE_SHIFT) | (x & (TILE_SIZE - 1));
+            return x & 63;
+        }
+        inline size_t chunkIndex(int x, int y) const
+        {
+            return (size_t)(y >> CHUNK_SHIFT)*m_chunksX + (x >> CHUNK_SHIFT);
+        }
+        inline uint64_t occupancyWord(int x, int y) const
+        {
+            if (m_layout == CHUNKED) return m_occupancyChunks[chunkIndex(x, y)][y & (CHUNK_SIZE - 1)];
+            return m_occupancy[wordIndex(x, y)];
+        }
+        
+        // for MapFile, which fills everything in
+        Map();
+        
+        // the chunk all empty CHUNKED chunks point to. Never written
+        static uint64_t* emptyOccupancyChunk();
+        static unsigned char* emptyMaterialChunk();
+        // the chunk ChunkStreamer puts where a chunk isn't loaded yet: all walls of
+        // OUTSIDE_MATERIAL. Never written either
+        static uint64_t* opaqueOccupancyChunk();
+        static unsigned char* opaqueMaterialChunk();
+        inline bool isChunkEmpty(size_t chunk) const
+        {
+            return m_occupancyChunks[chunk] == emptyOccupancyChunk();
+        }
+        // give the cell's chunk memory of its own if it is the shared empty one
+        void touchChunk(int x, int y);
+        // whether anything one level below block (bx, by) of level is occupied, cells
+        // for level 1
+        bool scanBlock(int level, int bx, int by) const;
+        // set the blocks over cells [x0; x1) x [y0; y1) from the cells again, for
+        // ChunkStreamer after it swapped a chunk's cells
+        void rebuildBlocks(int x0, int y0, int x1, int y1);
+        // distances of cells [x0; x1) x [y0; y1) into out, a row after another. Only walls
+        // in that rectangle and the outside of the map are taken into account
+        void distanceTransform(int x0, int y0, int x1, int y1, unsigned char *out) const;
+    
+    public:
+        Map(int width, int height, Layout layout = ROW_MAJOR);
+        Map(const Map&) = delete;
+        ~Map();
+        
+        inline int width() const
+        {
+            return m_width;
+        }
+        inline int height() const
+        {
+            return m_height;
+        }
+        inline Layout layout() const
+        {
+            return m_layout;
+        }
+        // chunks in a row of the map. Chunk i has cells from x (i % chunksX()) and y
+        // (i / chunksX()) times CHUNK_SIZE on
+        inline int chunksX() const
+        {
+            return m_chunksX;
+        }
+        // negative coordinates wrap to huge unsigned ones, so one compare per axis
+        inline bool contains(int x, int y) const
+        {
+            return (unsigned)x < (unsigned)m_width && (unsigned)y < (unsigned)m_height;
+        }
+        inline bool isWall(int x, int y) const
+        {
+            if (!contains(x, y)) return true;
+            return (occupancyWord(x, y) >> bitIndex(x, y)) & 1;
+        }
+        inline unsigned char material(int x, int y) const
+        {
+            if (!contains(x, y)) return OUTSIDE_MATERIAL;
+            if (m_layout == CHUNKED)
+            {
+                return m_materialChunks[chunkIndex(x, y)][(y & (CHUNK_SIZE - 1))*CHUNK_SIZE + (x & (CHUNK_SIZE - 1))];
+            }
+            return m_materials[(size_t)y*m_width + x];
+        }
+        // level in [1; BLOCK_LEVELS], block coordinates are cell ones shifted right by
+        // level * BLOCK_SHIFT
+        inline bool isBlockOccupied(int level, int bx, int by) const
+        {
+            return m_blocks[level - 1].get(bx, by);
+        }
+        
+        // build the distance field. Load the cells first, edits after this are slower
+        void buildDistanceField();
+        inline bool hasDistanceField() const
+        {
+            return m_distances != nullptr;
+        }
+        inline int distance(int x, int y) const
+        {
+            if (!contains(x, y)) return 0;
+            return m_distances[(size_t)y*m_width + x];
+        }
+        
+        // any material but EMPTY makes the cell a wall. Blocks around the cell are
+        // updated right away. False if the cell is in a chunk that isn't streamed in,
+        // the edit is dropped then
+        bool setCell(int x, int y, unsigned char material);
+        inline bool setWall(int x, int y, bool wall)
+        {
+            return setCell(x, y, wall ? 1 : EMPTY);
+        }
+        
+        // the ROW_MAJOR or TILED occupancy plane as it is, for code that reads it in bulk
+        inline const uint64_t* occupancy() const
+        {
+            return m_occupancy.data();
+        }
+        inline int wordsPerRow() const
+        {
+            return m_wordsPerRow;
+        }
+        inline const uint32_t* mortonX() const
+        {
+            return m_mortonX.data();
+        }
+        inline const uint32_t* mortonY() const
+        {
+            return m_mortonY.data();
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,99 @@
+// Turns a text or image level into a binary map file the raycaster maps in place.
+// Text: a line per row, '#' is a wall of material 1, '1'-'9' a wall of that
+// material, '.', ' ' and '0' are empty; short lines are padded with empty cells.
+// Images: every dark pixel is a wall of material 1
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+#include "Image.h"
+#include "Map.h"
+#include "MapFile.h"
+
+auto console = spdlog::stdout_color_st("console");
+
+static bool endsWith(const std::string &s, const char *suffix)
+{
+    size_t n = strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+static std::unique_ptr<raycaster::Map> loadText(const char *file)
+{
+    std::ifstream in(file);
+    if (!in)
+    {
+        console->error("\"{0}\" can't be opened", file);
+        return nullptr;
+    }
+    std::vector<std::string> lines;
+    std::string line;
+    size_t width = 0;
+    while (std::getline(in, line))
+    {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        width = std::max(width, line.size());
+        lines.push_back(line);
+    }
+    if (width == 0 || width > raycaster::Map::MAX_SIZE || lines.size() > raycaster::Map::MAX_SIZE)
+    {
+        console->error("\"{0}\" is empty or too big", file);
+        return nullptr;
+    }
+    
+    std::unique_ptr<raycaster::Map> map(new raycaster::Map((int)width, (int)lines.size(), raycaster::Map::CHUNKED));
+    for (size_t y = 0; y < lines.size(); ++y)
+    {
+        for (size_t x = 0; x < lines[y].size(); ++x)
+        {
+            char c = lines[y][x];
+            if (c == '#') map->setCell((int)x, (int)y, 1);
+            else if ('1' <= c && c <= '9') map->setCell((int)x, (int)y, (unsigned char)(c - '0'));
+            else if (c != '.' && c != ' ' && c != '0')
+            {
+                console->error("\"{0}\": unknown cell '{1}' at {2}:{3}", file, c, y + 1, x + 1);
+                return nullptr;
+            }
+        }
+    }
+    return map;
+}
+
+static std::unique_ptr<raycaster::Map> loadImage(const char *file)
+{
+    core::Image image;
+    if (!image.loadFromFile(file)) return nullptr;
+    if (image.width() > raycaster::Map::MAX_SIZE || image.height() > raycaster::Map::MAX_SIZE)
+    {
+        console->error("\"{0}\" is too big", file);
+        return nullptr;
+    }
+    std::unique_ptr<raycaster::Map> map(new raycaster::Map(image.width(), image.height(), raycaster::Map::CHUNKED));
+    for (int y = 0; y < image.height(); ++y)
+    {
+        for (int x = 0; x < image.width(); ++x)
+        {
+            core::Pixel p = image.pixel(x, y);
+            if (core::pixelRed(p) + core::pixelGreen(p) + core::pixelBlue(p) < 3 * 128) map->setCell(x, y, 1);
+        }
+    }
+    return map;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3 || (argc == 4 && strcmp(argv[3], "--distance-field") != 0) || argc > 4)
+    {
+        console->info("Usage: {0} <input.txt|input.png> <output> [--distance-field]", argv[0]);
+        return 1;
+    }
+    std::string input = argv[1];
+    std::unique_ptr<raycaster::Map> map = endsWith(input, ".png") ? loadImage(argv[1]) : loadText(argv[1]);
+    if (!map) return 1;
+    if (argc == 4) map->buildDistanceField();
+    return raycaster::MapFile::save(*map, argv[2]) ? 0 : 1;
+}
@@ -0,0 +1,303 @@
+#include "MapFile.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+#include "MappedFile.h"
+
+namespace raycaster
+{
+    struct FileHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t width, height;
+        uint32_t chunkSize;
+        uint32_t sectionCount;
+    };
+    
+    struct SectionEntry
+    {
+        uint32_t type;
+        uint32_t flags;
+        uint64_t offset;
+        uint64_t size;
+    };
+    
+    static const char MAGIC[4] = {'R', 'C', 'M', 'P'};
+    
+    // the format is the memory of a little endian machine, others would need to swap
+    static bool isLittleEndian()
+    {
+        uint16_t one = 1;
+        unsigned char first;
+        memcpy(&first, &one, 1);
+        return first == 1;
+    }
+    
+    static uint64_t alignSection(uint64_t offset)
+    {
+        return (offset + MapFile::SECTION_ALIGNMENT - 1) / MapFile::SECTION_ALIGNMENT * MapFile::SECTION_ALIGNMENT;
+    }
+    
+    static size_t blockWords(const Map &map)
+    {
+        size_t words = 0;
+        for (int level = 1; level <= Map::BLOCK_LEVELS; ++level)
+        {
+            int size = 1 << (level * Map::BLOCK_SHIFT);
+            words += BitPlane::wordsNeeded((map.width() + size - 1) / size, (map.height() + size - 1) / size);
+        }
+        return words;
+    }
+    
+    std::unique_ptr<Map> MapFile::load(const char *file)
+    {
+        auto console = spdlog::get("console");
+        if (!isLittleEndian())
+        {
+            console->error("Map \"{0}\": only little endian machines can read map files", file);
+            return nullptr;
+        }
+        std::shared_ptr<core::MappedFile> mapped(new core::MappedFile());
+        if (!mapped->open(file))
+        {
+            console->error("Map \"{0}\" can't be opened", file);
+            return nullptr;
+        }
+        const unsigned char *data = mapped->data();
+        size_t fileSize = mapped->size();
+        
+        FileHeader header;
+        if (fileSize < sizeof(header))
+        {
+            console->error("Map \"{0}\" is too short", file);
+            return nullptr;
+        }
+        memcpy(&header, data, sizeof(header));
+        if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION)
+        {
+            console->error("Map \"{0}\" is not a version {1} map file", file, (unsigned)VERSION);
+            return nullptr;
+        }
+        if (header.width == 0 || header.width > (uint32_t)Map::MAX_SIZE
+            || header.height == 0 || header.height > (uint32_t)Map::MAX_SIZE
+            || header.chunkSize != (uint32_t)Map::CHUNK_SIZE)
+        {
+            console->error("Map \"{0}\" has bad dimensions {1}x{2}, chunk {3}", file, header.width, header.height, header.chunkSize);
+            return nullptr;
+        }
+        if (header.sectionCount > (fileSize - sizeof(header)) / sizeof(SectionEntry))
+        {
+            console->error("Map \"{0}\": section table doesn't fit in the file", file);
+            return nullptr;
+        }
+        
+        std::unique_ptr<Map> map(new Map());
+        map->m_width = (int)header.width;
+        map->m_height = (int)header.height;
+        map->m_wordsPerRow = (map->m_width + 63) / 64;
+        map->m_chunksX = (map->m_width + Map::CHUNK_SIZE - 1) >> Map::CHUNK_SHIFT;
+        map->m_chunksY = (map->m_height + Map::CHUNK_SIZE - 1) >> Map::CHUNK_SHIFT;
+        size_t chunkCount = (size_t)map->m_chunksX * map->m_chunksY;
+        
+        // find the sections, each one must lie in the file, be aligned and be there once
+        unsigned char *sections[DISTANCES + 1] = {};
+        uint64_t sizes[DISTANCES + 1] = {};
+        for (uint32_t i = 0; i < header.sectionCount; ++i)
+        {
+            SectionEntry entry;
+            memcpy(&entry, data + sizeof(header) + i * sizeof(entry), sizeof(entry));
+            if (entry.type < CHUNK_INDEX || entry.type > DISTANCES)
+            {
+                // from a newer writer, can be skipped
+                continue;
+            }
+            if (entry.offset % SECTION_ALIGNMENT != 0 || entry.offset > fileSize || entry.size > fileSize - entry.offset
+                || sections[entry.type] != nullptr)
+            {
+                console->error("Map \"{0}\": section {1} is broken", file, entry.type);
+                return nullptr;
+            }
+            sections[entry.type] = mapped->data() + entry.offset;
+            sizes[entry.type] = entry.size;
+        }
+        
+        const size_t chunkBytes = Map::CHUNK_SIZE * sizeof(uint64_t);
+        const size_t materialBytes = Map::CHUNK_SIZE * Map::CHUNK_SIZE;
+        if (!sections[CHUNK_INDEX] || !sections[OCCUPANCY] || !sections[MATERIALS] || !sections[BLOCKS]
+            || sizes[CHUNK_INDEX] != chunkCount * sizeof(uint32_t)
+            || sizes[OCCUPANCY] % chunkBytes != 0
+            || sizes[MATERIALS] != sizes[OCCUPANCY] / chunkBytes * materialBytes
+            || sizes[BLOCKS] != blockWords(*map) * sizeof(uint64_t)
+            || (sections[DISTANCES] && sizes[DISTANCES] != (uint64_t)map->m_width * map->m_height))
+        {
+            console->error("Map \"{0}\": sections are missing or have wrong sizes", file);
+            return nullptr;
+        }
+        
+        // only the index is read now, chunks are pointed to where they are mapped
+        size_t storedChunks = (size_t)(sizes[OCCUPANCY] / chunkBytes);
+        const uint32_t *index = (const uint32_t*)sections[CHUNK_INDEX];
+        map->m_occupancyChunks.resize(chunkCount);
+        map->m_materialChunks.resize(chunkCount);
+        for (size_t chunk = 0; chunk < chunkCount; ++chunk)
+        {
+            if (index[chunk] == NO_CHUNK)
+            {
+                map->m_occupancyChunks[chunk] = Map::emptyOccupancyChunk();
+                map->m_materialChunks[chunk] = Map::emptyMaterialChunk();
+            }
+            else if (index[chunk] < storedChunks)
+            {
+                map->m_occupancyChunks[chunk] = (uint64_t*)(sections[OCCUPANCY] + index[chunk] * chunkBytes);
+                map->m_materialChunks[chunk] = sections[MATERIALS] + index[chunk] * materialBytes;
+            }
+            else
+            {
+                console->error("Map \"{0}\": chunk {1} points to missing data", file, chunk);
+                return nullptr;
+            }
+        }
+        
+        uint64_t *words = (uint64_t*)sections[BLOCKS];
+        for (int level = 1; level <= Map::BLOCK_LEVELS; ++level)
+        {
+            int size = 1 << (level * Map::BLOCK_SHIFT);
+            int width = (map->m_width + size - 1) / size, height = (map->m_height + size - 1) / size;
+            map->m_blocks[level - 1] = BitPlane(width, height, words);
+            words += BitPlane::wordsNeeded(width, height);
+        }
+        map->m_distances = sections[DISTANCES];
+        map->m_file = mapped;
+        
+        console->info("Map \"{0}\" {1}x{2} mapped, {3} of {4} chunks have walls{5}", file, map->m_width, map->m_height,
+                      storedChunks, chunkCount, map->hasDistanceField() ? ", with a distance field" : "");
+        return map;
+    }
+    
+    bool MapFile::save(const Map &map, const char *file)
+    {
+        auto console = spdlog::get("console");
+        if (!isLittleEndian())
+        {
+            console->error("Map \"{0}\": only little endian machines can write map files", file);
+            return false;
+        }
+        
+        // gather the chunks with walls in them, the rest are left out
+        size_t chunkCount = (size_t)map.m_chunksX * map.m_chunksY;
+        std::vector<uint32_t> index(chunkCount, (uint32_t)NO_CHUNK);
+        std::vector<uint64_t> occupancy;
+        std::vector<unsigned char> materials;
+        uint64_t rows[Map::CHUNK_SIZE];
+        unsigned char cells[Map::CHUNK_SIZE * Map::CHUNK_SIZE];
+        for (int cy = 0; cy < map.m_chunksY; ++cy)
+        {
+            for (int cx = 0; cx < map.m_chunksX; ++cx)
+            {
+                size_t chunk = (size_t)cy * map.m_chunksX + cx;
+                if (map.m_layout == Map::CHUNKED)
+                {
+                    memcpy(rows, map.m_occupancyChunks[chunk], sizeof(rows));
+                    memcpy(cells, map.m_materialChunks[chunk], sizeof(cells));
+                }
+                else
+                {
+                    // cells past the edge of the map are written empty
+                    for (int y = 0; y < Map::CHUNK_SIZE; ++y)
+                    {
+                        rows[y] = 0;
+                        for (int x = 0; x < Map::CHUNK_SIZE; ++x)
+                        {
+                            int mx = (cx << Map::CHUNK_SHIFT) + x, my = (cy << Map::CHUNK_SHIFT) + y;
+                            bool inside = map.contains(mx, my);
+                            rows[y] |= (uint64_t)(inside && map.isWall(mx, my)) << x;
+                            cells[y * Map::CHUNK_SIZE + x] = inside ? map.material(mx, my) : Map::EMPTY;
+                        }
+                    }
+                }
+                
+                bool empty = true;
+                for (int y = 0; y < Map::CHUNK_SIZE && empty; ++y)
+                {
+                    empty = rows[y] == 0;
+                }
+                if (empty) continue;
+                index[chunk] = (uint32_t)(occupancy.size() / Map::CHUNK_SIZE);
+                occupancy.insert(occupancy.end(), rows, rows + Map::CHUNK_SIZE);
+                materials.insert(materials.end(), cells, cells + sizeof(cells));
+            }
+        }
+        
+        std::vector<uint64_t> blocks;
+        for (int level = 1; level <= Map::BLOCK_LEVELS; ++level)
+        {
+            const BitPlane &plane = map.m_blocks[level - 1];
+            const uint64_t *words = plane.words();
+            blocks.insert(blocks.end(), words, words + BitPlane::wordsNeeded(plane.width(), plane.height()));
+        }
+        
+        struct Payload
+        {
+            SectionType type;
+            const void *data;
+            size_t size;
+        };
+        std::vector<Payload> payloads;
+        payloads.push_back({CHUNK_INDEX, index.data(), index.size() * sizeof(uint32_t)});
+        payloads.push_back({OCCUPANCY, occupancy.data(), occupancy.size() * sizeof(uint64_t)});
+        payloads.push_back({MATERIALS, materials.data(), materials.size()});
+        payloads.push_back({BLOCKS, blocks.data(), blocks.size() * sizeof(uint64_t)});
+        if (map.hasDistanceField())
+        {
+            payloads.push_back({DISTANCES, map.m_distances, (size_t)map.m_width * map.m_height});
+        }
+        
+        FileHeader header;
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.width = (uint32_t)map.m_width;
+        header.height = (uint32_t)map.m_height;
+        header.chunkSize = Map::CHUNK_SIZE;
+        header.sectionCount = (uint32_t)payloads.size();
+        std::vector<SectionEntry> entries(payloads.size());
+        uint64_t offset = alignSection(sizeof(header) + entries.size() * sizeof(SectionEntry));
+        for (size_t i = 0; i < payloads.size(); ++i)
+        {
+            entries[i].type = payloads[i].type;
+            entries[i].flags = 0;
+            entries[i].offset = offset;
+            entries[i].size = payloads[i].size;
+            offset = alignSection(offset + payloads[i].size);
+        }
+        
+        FILE *out = fopen(file, "wb");
+        if (!out)
+        {
+            console->error("Map \"{0}\" can't be written", file);
+            return false;
+        }
+        bool ok = fwrite(&header, sizeof(header), 1, out) == 1
+                  && fwrite(entries.data(), sizeof(SectionEntry), entries.size(), out) == entries.size();
+        uint64_t written = sizeof(header) + entries.size() * sizeof(SectionEntry);
+        const char zeros[SECTION_ALIGNMENT] = {};
+        for (size_t i = 0; ok && i < payloads.size(); ++i)
+        {
+            ok = fwrite(zeros, 1, (size_t)(entries[i].offset - written), out) == entries[i].offset - written
+                 && fwrite(payloads[i].data, 1, payloads[i].size, out) == payloads[i].size;
+            written = entries[i].offset + payloads[i].size;
+        }
+        ok = fclose(out) == 0 && ok;
+        if (!ok)
+        {
+            console->error("Map \"{0}\" can't be written", file);
+            return false;
+        }
+        console->info("Map \"{0}\" {1}x{2} saved, {3} of {4} chunks have walls", file, map.m_width, map.m_height,
+                      occupancy.size() / Map::CHUNK_SIZE, chunkCount);
+        return true;
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef MAP_FILE_H
+#define MAP_FILE_H
+
+#include <stdint.h>
+#include <memory>
+
+#include "Map.h"
+
+namespace raycaster
+{
+    // Binary map files, little endian. A header
+    //     char magic[4] = "RCMP"; uint32 version, width, height, chunkSize, sectionCount
+    // is followed by sectionCount entries {uint32 type, flags; uint64 offset, size}.
+    // Sections start at multiples of SECTION_ALIGNMENT, so they can be used right where
+    // they are mapped:
+    //     CHUNK_INDEX - uint32 per chunk, row by row: index of the chunk's data in the
+    //                   next two sections or NO_CHUNK for a chunk without walls
+    //     OCCUPANCY   - CHUNK_SIZE uint64 rows of every stored chunk, bit x of a row is
+    //                   cell x of it
+    //     MATERIALS   - CHUNK_SIZE * CHUNK_SIZE bytes of every stored chunk, row by row
+    //     BLOCKS      - the block pyramid, level after level, planes as in BitPlane
+    //     DISTANCES   - optional, the distance field, a byte per cell row by row
+    class MapFile
+    {
+    public:
+        enum SectionType
+        {
+            CHUNK_INDEX = 1,
+            OCCUPANCY,
+            MATERIALS,
+            BLOCKS,
+            DISTANCES
+        };
+        
+        const static uint32_t VERSION = 1;
+        const static uint32_t NO_CHUNK = 0xffffffff;
+        const static int SECTION_ALIGNMENT = 4096;
+        
+        // Map the file and make a CHUNKED map on top of it without reading it: pages of
+        // chunks come from disk the first time a ray goes there. Edits stay in memory.
+        // nullptr if the file is missing or broken, the reason is logged
+        static std::unique_ptr<Map> load(const char *file);
+        // any layout can be saved, the distance field goes too if the map has it
+        static bool save(const Map &map, const char *file);
+    };
+}
+
+#endif
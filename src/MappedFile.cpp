@@ -0,0 +1,97 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace core
+{
+    MappedFile::MappedFile()
+    : m_data(nullptr),
+    m_size(0)
+#ifdef _WIN32
+    ,m_file(INVALID_HANDLE_VALUE),
+    m_mapping(nullptr)
+#endif
+    {}
+    
+    MappedFile::~MappedFile()
+    {
+        close();
+    }
+
+#ifdef _WIN32
+    bool MappedFile::open(const char *file)
+    {
+        close();
+        m_file = CreateFileA(file, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
+        {
+            close();
+            return false;
+        }
+        // copy on write, like MAP_PRIVATE
+        m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+        if (m_mapping == nullptr)
+        {
+            close();
+            return false;
+        }
+        m_data = (unsigned char*)MapViewOfFile(m_mapping, FILE_MAP_COPY, 0, 0, 0);
+        if (m_data == nullptr)
+        {
+            close();
+            return false;
+        }
+        m_size = (size_t)size.QuadPart;
+        return true;
+    }
+    
+    void MappedFile::close()
+    {
+        if (m_data) UnmapViewOfFile(m_data);
+        if (m_mapping) CloseHandle(m_mapping);
+        if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+        m_data = nullptr;
+        m_size = 0;
+        m_mapping = nullptr;
+        m_file = INVALID_HANDLE_VALUE;
+    }
+#else
+    bool MappedFile::open(const char *file)
+    {
+        close();
+        int fd = ::open(file, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        // the mapping keeps the file alive by itself
+        void *data = mmap(nullptr, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) return false;
+        m_data = (unsigned char*)data;
+        m_size = (size_t)info.st_size;
+        return true;
+    }
+    
+    void MappedFile::close()
+    {
+        if (m_data) munmap(m_data, m_size);
+        m_data = nullptr;
+        m_size = 0;
+    }
+#endif
+}
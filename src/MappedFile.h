@@ -0,0 +1,44 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stddef.h>
+
+namespace core
+{
+    // A whole file mapped into memory. Pages are read from disk the first time they are
+    // touched, so opening a big file is cheap and parts nobody looks at are never read.
+    // The mapping is private: writes go to copies of the pages and never reach the file
+    class MappedFile
+    {
+    private:
+        unsigned char *m_data;
+        size_t m_size;
+#ifdef _WIN32
+        void *m_file, *m_mapping;
+#endif
+    
+    public:
+        MappedFile();
+        MappedFile(const MappedFile&) = delete;
+        ~MappedFile();
+        
+        // false if the file can't be opened or is empty
+        bool open(const char *file);
+        void close();
+        
+        inline unsigned char* data()
+        {
+            return m_data;
+        }
+        inline const unsigned char* data() const
+        {
+            return m_data;
+        }
+        inline size_t size() const
+        {
+            return m_size;
+        }
+    };
+}
+
+#endif
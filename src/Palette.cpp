@@ -0,0 +1,113 @@
+#include "Palette.h"
+
+#include <assert.h>
+#include <algorithm>
+
+namespace core
+{
+    // channel 0 is red, 1 green, 2 blue
+    static inline unsigned channel(Pixel p, int c)
+    {
+        return (p >> (16 - 8 * c)) & 0xff;
+    }
+    
+    // samples [begin; end) and the channel they spread over most
+    struct ColorBox
+    {
+        size_t begin, end;
+        int channel;
+        unsigned range;
+        
+        ColorBox(const std::vector<Pixel> &samples, size_t begin, size_t end)
+        : begin(begin), end(end), channel(0), range(0)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                unsigned lo = 255, hi = 0;
+                for (size_t i = begin; i < end; ++i)
+                {
+                    lo = std::min(lo, core::channel(samples[i], c));
+                    hi = std::max(hi, core::channel(samples[i], c));
+                }
+                if (begin < end && hi - lo >= range)
+                {
+                    range = hi - lo;
+                    channel = c;
+                }
+            }
+        }
+    };
+    
+    Palette::Palette()
+    {
+        std::fill(m_colors, m_colors + SIZE, packPixel(0, 0, 0));
+    }
+    
+    void Palette::build(const std::vector<Pixel> &samples, const std::vector<Pixel> &fixed)
+    {
+        assert(fixed.size() < (size_t)SIZE);
+        std::fill(m_colors, m_colors + SIZE, packPixel(0, 0, 0));
+        std::copy(fixed.begin(), fixed.end(), m_colors);
+        if (samples.empty()) return;
+        
+        std::vector<Pixel> sorted(samples);
+        std::vector<ColorBox> boxes(1, ColorBox(sorted, 0, sorted.size()));
+        while (boxes.size() + fixed.size() < (size_t)SIZE)
+        {
+            // the widest box that can still be split
+            size_t widest = boxes.size();
+            for (size_t i = 0; i < boxes.size(); ++i)
+            {
+                if (boxes[i].range > 0 && (widest == boxes.size() || boxes[i].range > boxes[widest].range))
+                {
+                    widest = i;
+                }
+            }
+            if (widest == boxes.size()) break;
+            
+            ColorBox box = boxes[widest];
+            size_t middle = box.begin + (box.end - box.begin) / 2;
+            int c = box.channel;
+            std::nth_element(sorted.begin() + box.begin, sorted.begin() + middle, sorted.begin() + box.end,
+                             [c](Pixel a, Pixel b) { return channel(a, c) < channel(b, c); });
+            boxes[widest] = ColorBox(sorted, box.begin, middle);
+            boxes.push_back(ColorBox(sorted, middle, box.end));
+        }
+        
+        for (size_t i = 0; i < boxes.size(); ++i)
+        {
+            unsigned sum[3] = { 0, 0, 0 };
+            size_t count = boxes[i].end - boxes[i].begin;
+            for (size_t j = boxes[i].begin; j < boxes[i].end; ++j)
+            {
+                for (int c = 0; c < 3; ++c)
+                {
+                    sum[c] += channel(sorted[j], c);
+                }
+            }
+            m_colors[fixed.size() + i] = packPixel((sum[0] + count / 2) / count, (sum[1] + count / 2) / count,
+                                                   (sum[2] + count / 2) / count);
+        }
+    }
+    
+    unsigned char Palette::nearest(Pixel p) const
+    {
+        int best = 0;
+        int bestDist = 0x7fffffff;
+        for (int i = 0; i < SIZE && bestDist > 0; ++i)
+        {
+            int dist = 0;
+            for (int c = 0; c < 3; ++c)
+            {
+                int d = (int)channel(p, c) - (int)channel(m_colors[i], c);
+                dist += d * d;
+            }
+            if (dist < bestDist)
+            {
+                bestDist = dist;
+                best = i;
+            }
+        }
+        return (unsigned char)best;
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <vector>
+
+#include "Image.h"
+
+namespace core
+{
+    // 256 colors for images of one byte per pixel. Indices go to OpenGL in a GL_R8
+    // texture and the palette in a 256x1 one, the shader puts them together
+    class Palette
+    {
+    public:
+        const static int SIZE = 256;
+    
+    private:
+        Pixel m_colors[SIZE];
+    
+    public:
+        // all black
+        Palette();
+        
+        // Pick the colors for the samples by median cut: the samples are split in two
+        // at the median of the channel they spread over most, the group that spreads
+        // the most is split next and so on until there is a group per color, which
+        // gets their average. Colors in fixed are taken as they are, before the others
+        void build(const std::vector<Pixel> &samples, const std::vector<Pixel> &fixed);
+        // index of the closest color, by squared distance over red, green and blue
+        unsigned char nearest(Pixel p) const;
+        
+        inline Pixel color(int i) const
+        {
+            return m_colors[i];
+        }
+        inline const Pixel* colors() const
+        {
+            return m_colors;
+        }
+    };
+}
+
+#endif
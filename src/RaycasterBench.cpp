@@ -0,0 +1,171 @@
+// Renders frames without a window and prints how long they take, so the renderer's
+// options can be compared on the machine at hand:
+//   RaycasterBench [WIDTHxHEIGHT ...] [--frames N] [--threads N]
+//                  [--layout row|tiled|chunked] [--map N] [--walls PERCENT] [--distance D]
+// Every size is drawn into a row-major frame directly and through the column-major
+// buffer and its transpose (Renderer::setColumnMajor). Without sizes it does 320x280,
+// 1280x720 and 3840x2160. The map is the demo board and the camera turns around on
+// the spot, as in a --headless run. With --map it is N x N cells with PERCENT of them
+// walls at random (0.2 by default) and every frame is seen from a random pose, the
+// same ones for every layout. --layout picks how Map packs the cells, --distance
+// how far rays go. Textures come from resources/, run it from the directory the
+// build copies them to
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+#include "RaycasterEngine.h"
+#include "RaycasterSimd.h"
+#include "TextureAtlas.h"
+
+auto console = spdlog::stdout_color_st("console");
+
+const int BOARD_SIZE = 16;
+// frames drawn before timing starts, so caches and the thread pool are warm
+const int WARMUP_FRAMES = 5;
+const unsigned RANDOM_SEED = 7;
+
+struct FrameSize
+{
+    int width, height;
+};
+
+// ms per frame of the poses drawn by renderer into a width x height frame, after
+// some of them as a warm-up
+static double timeFrames(raycaster::Renderer &renderer, const raycaster::Map &map, int width, int height,
+                         const std::vector<raycaster::Camera> &poses)
+{
+    std::vector<core::Pixel> pixels((size_t)width * height);
+    raycaster::FrameBuffer frame(pixels.data(), width, height);
+    int frames = (int)poses.size();
+    double total = 0.;
+    for (int i = -WARMUP_FRAMES; i < frames; ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+        renderer.renderFrame(poses[(i + frames) % frames], map, frame);
+        auto end = std::chrono::steady_clock::now();
+        if (i >= 0) total += std::chrono::duration<double, std::milli>(end - start).count();
+    }
+    return total / frames;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<FrameSize> sizes;
+    int frames = 100, threads = 1, mapSize = 0;
+    float walls = 0.2f, distance = 16.f;
+    raycaster::Map::Layout layout = raycaster::Map::ROW_MAJOR;
+    const char *LAYOUTS[] = { "row", "tiled", "chunked" };
+    for (int i = 1; i < argc; ++i)
+    {
+        FrameSize size;
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) frames = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--map") == 0 && i + 1 < argc) mapSize = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--walls") == 0 && i + 1 < argc) walls = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "--distance") == 0 && i + 1 < argc) distance = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "--layout") == 0 && i + 1 < argc)
+        {
+            ++i;
+            int l = 0;
+            while (l < 3 && strcmp(argv[i], LAYOUTS[l]) != 0) ++l;
+            if (l == 3)
+            {
+                console->error("Unknown layout \"{0}\", it is row, tiled or chunked", argv[i]);
+                return 1;
+            }
+            layout = (raycaster::Map::Layout)l;
+        }
+        else if (sscanf(argv[i], "%dx%d", &size.width, &size.height) == 2 && size.width > 0 && size.height > 0) sizes.push_back(size);
+        else
+        {
+            console->error("Unknown argument \"{0}\"", argv[i]);
+            console->info("Usage: {0} [WIDTHxHEIGHT ...] [--frames N] [--threads N] "
+                          "[--layout row|tiled|chunked] [--map N] [--walls PERCENT] [--distance D]", argv[0]);
+            return 1;
+        }
+    }
+    if (frames <= 0 || threads < 0 || mapSize < 0 || mapSize > raycaster::Map::MAX_SIZE || distance <= 0.f)
+    {
+        console->error("--frames, --distance must be positive, --threads not negative, --map up to {0}",
+                       (int)raycaster::Map::MAX_SIZE);
+        return 1;
+    }
+    if (sizes.empty())
+    {
+        sizes = { { 320, 280 }, { 1280, 720 }, { 3840, 2160 } };
+    }
+    
+    core::TextureAtlas textures(64, 1);
+    if (textures.addFromFile("resources/brick.png") < 0) return 1;
+    std::vector<raycaster::Camera> poses;
+    std::unique_ptr<raycaster::Map> map;
+    if (mapSize == 0)
+    {
+        // a closed room with a few pillars, looked around from the middle
+        map.reset(new raycaster::Map(BOARD_SIZE, BOARD_SIZE, layout));
+        for (int i = 0; i < BOARD_SIZE; ++i)
+        {
+            map->setWall(i, 0, true);
+            map->setWall(i, BOARD_SIZE - 1, true);
+            map->setWall(0, i, true);
+            map->setWall(BOARD_SIZE - 1, i, true);
+        }
+        map->setWall(4, 4, true);
+        map->setWall(3, 8, true);
+        map->setWall(12, 8, true);
+        map->setWall(12, 11, true);
+        for (int i = 0; i < frames; ++i)
+        {
+            poses.push_back(raycaster::Camera(raycaster::vec2<float>(BOARD_SIZE / 2 + 0.1f, BOARD_SIZE / 2 + 0.1f),
+                                              2.f * (float)M_PI * i / frames, (float)M_PI / 4.f));
+        }
+    }
+    else
+    {
+        // the seed is fixed, so every layout gets the same walls and poses
+        std::mt19937 random(RANDOM_SEED);
+        std::uniform_real_distribution<float> percent(0.f, 100.f), coord(0.f, (float)mapSize), angle(0.f, 2.f * (float)M_PI);
+        map.reset(new raycaster::Map(mapSize, mapSize, layout));
+        for (int y = 0; y < mapSize; ++y)
+        {
+            for (int x = 0; x < mapSize; ++x)
+            {
+                if (percent(random) < walls) map->setWall(x, y, true);
+            }
+        }
+        while ((int)poses.size() < frames)
+        {
+            raycaster::vec2<float> pos(coord(random), coord(random));
+            // the float draw can round up to mapSize itself
+            if ((int)pos.x >= mapSize || (int)pos.y >= mapSize || map->isWall((int)pos.x, (int)pos.y)) continue;
+            poses.push_back(raycaster::Camera(pos, angle(random), (float)M_PI / 3.f));
+        }
+    }
+    
+    raycaster::Renderer renderer;
+    renderer.setWallTextures(&textures);
+    renderer.setThreadCount(threads);
+    renderer.setMaxDistance(distance);
+    console->info("Ray kernel: {0}, render threads: {1}, {2} layout, {3}x{4} map, {5} frames per run",
+                  raycaster::rayKernelName(renderer.rayKernel()), renderer.threadCount(), LAYOUTS[layout],
+                  map->width(), map->height(), frames);
+    for (const FrameSize &size : sizes)
+    {
+        renderer.setColumnMajor(false);
+        double rowMajor = timeFrames(renderer, *map, size.width, size.height, poses);
+        renderer.setColumnMajor(true);
+        double columnMajor = timeFrames(renderer, *map, size.width, size.height, poses);
+        console->info("{0}x{1}: row-major {2:.3f} ms/frame, column-major {3:.3f} ms/frame",
+                      size.width, size.height, rowMajor, columnMajor);
+    }
+    return 0;
+}
@@ -1,10 +1,17 @@
 #include <algorithm>
+#include <stdint.h>
+#include <string.h>
 #define _USE_MATH_DEFINES
 #include <math.h>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RAYCASTER_SSE2
+#endif
 
 #include "spdlog/spdlog.h"
 
 #include "RaycasterEngine.h"
+#include "RaycasterSimd.h"
 
 namespace raycaster
 {
@@ -24,63 +31,690 @@ namespace raycaster
     {
         return vec2<float>(getFraction(v.x), getFraction(v.y));
     }
-    int getOctant(float angle)
+    RayHit castRay(const Map &map, vec2<float> pos, vec2<float> dir, float maxDist)
     {
-        const static double M_PI_3_4 = M_PI_2 + M_PI_4;
-        if (inB<float>(angle, -M_PI, -M_PI_3_4))
-            return 5;
-        if (inB<float>(angle, -M_PI_3_4, -M_PI_2))
-            return 6;
-        if (inB<float>(angle, -M_PI_2, -M_PI_4))
-            return 7;
-        if (inB<float>(angle, -M_PI_4, 0.))
-            return 8;
-        if (inB<float>(angle, 0., M_PI_4))
-            return 1;
-        if (inB<float>(angle, M_PI_4, M_PI_2))
-            return 2;
-        if (inB<float>(angle, M_PI_2, M_PI_3_4))
-            return 3;
-        if (inB<float>(angle, M_PI_3_4, M_PI))
-            return 4;
-        return -1;
+        RayHit hit;
+        hit.cell = vec2<int>(floorf(pos.x), floorf(pos.y));
+        hit.dist = 0.f;
+        hit.side = 0;
+        
+        // distance along the ray between two vertical (x) and two horizontal (y) cell borders
+        vec2<float> deltaDist(dir.x != 0.f ? fabsf(1.f / dir.x) : INFINITY,
+                              dir.y != 0.f ? fabsf(1.f / dir.y) : INFINITY);
+        vec2<int> step(dir.x < 0.f ? -1 : 1, dir.y < 0.f ? -1 : 1);
+        // distance along the ray to the first vertical and horizontal border
+        vec2<float> sideDist(dir.x < 0.f ? pos.x - hit.cell.x : hit.cell.x + 1.f - pos.x,
+                             dir.y < 0.f ? pos.y - hit.cell.y : hit.cell.y + 1.f - pos.y);
+        sideDist.x = dir.x != 0.f ? sideDist.x * deltaDist.x : INFINITY;
+        sideDist.y = dir.y != 0.f ? sideDist.y * deltaDist.y : INFINITY;
+        
+        while (!map.isWall(hit.cell.x, hit.cell.y))
+        {
+            // cross whichever border is closer
+            if (sideDist.x < sideDist.y)
+            {
+                hit.dist = sideDist.x;
+                if (hit.dist >= maxDist) break;
+                sideDist.x += deltaDist.x;
+                hit.cell.x += step.x;
+                hit.side = 0;
+            }
+            else
+            {
+                hit.dist = sideDist.y;
+                if (hit.dist >= maxDist) break;
+                sideDist.y += deltaDist.y;
+                hit.cell.y += step.y;
+                hit.side = 1;
+            }
+        }
+        hit.wall = hit.dist < maxDist;
+        hit.u = hitTextureU(hit, pos, dir);
+        return hit;
+    }
+    
+    // DDA state of a ray for the traversals that jump: a jump leaves a square of empty
+    // cells in one step and starts the DDA over behind it
+    struct RayWalker
+    {
+        vec2<float> pos, dir;
+        vec2<float> deltaDist, sideDist;
+        vec2<int> step;
+        
+        RayWalker(vec2<float> pos, vec2<float> dir, RayHit &hit)
+        : pos(pos), dir(dir),
+        deltaDist(dir.x != 0.f ? fabsf(1.f / dir.x) : INFINITY,
+                  dir.y != 0.f ? fabsf(1.f / dir.y) : INFINITY),
+        step(dir.x < 0.f ? -1 : 1, dir.y < 0.f ? -1 : 1)
+        {
+            hit.cell = vec2<int>(floorf(pos.x), floorf(pos.y));
+            hit.dist = 0.f;
+            hit.side = 0;
+            restart(hit);
+        }
+        
+        // distances to the next borders from the cell of the hit
+        inline void restart(const RayHit &hit)
+        {
+            sideDist.x = dir.x != 0.f ? fabsf((step.x > 0 ? hit.cell.x + 1 : hit.cell.x) - pos.x) * deltaDist.x : INFINITY;
+            sideDist.y = dir.y != 0.f ? fabsf((step.y > 0 ? hit.cell.y + 1 : hit.cell.y) - pos.y) * deltaDist.y : INFINITY;
+        }
+        
+        // cross the closer border like castRay() does. False if it's beyond maxDist
+        inline bool stepCell(float maxDist, RayHit &hit)
+        {
+            if (sideDist.x < sideDist.y)
+            {
+                hit.dist = sideDist.x;
+                if (hit.dist >= maxDist) return false;
+                sideDist.x += deltaDist.x;
+                hit.cell.x += step.x;
+                hit.side = 0;
+            }
+            else
+            {
+                hit.dist = sideDist.y;
+                if (hit.dist >= maxDist) return false;
+                sideDist.y += deltaDist.y;
+                hit.cell.y += step.y;
+                hit.side = 1;
+            }
+            return true;
+        }
+        
+        // go out of the empty square of cells [first; first + size) the hit cell is in.
+        // False if the ray ends inside it
+        inline bool leaveSquare(vec2<int> first, int size, float maxDist, RayHit &hit)
+        {
+            // distance to the borders the ray goes out through
+            float exitX = fabsf((step.x > 0 ? first.x + size : first.x) - pos.x) * deltaDist.x;
+            float exitY = fabsf((step.y > 0 ? first.y + size : first.y) - pos.y) * deltaDist.y;
+            float exit = std::min(exitX, exitY);
+            if (exit >= maxDist) return false;
+            
+            // the cell behind the border. Along the other axis it's where the ray is, kept
+            // inside the square against rounding. Empty squares are inside the map, never
+            // at negative coordinates, so truncating is as good as floorf() there
+            if (exitX < exitY)
+            {
+                hit.cell.x = step.x > 0 ? first.x + size : first.x - 1;
+                hit.cell.y = std::min(std::max((int)(pos.y + exit * dir.y), first.y), first.y + size - 1);
+                hit.side = 0;
+            }
+            else
+            {
+                hit.cell.y = step.y > 0 ? first.y + size : first.y - 1;
+                hit.cell.x = std::min(std::max((int)(pos.x + exit * dir.x), first.x), first.x + size - 1);
+                hit.side = 1;
+            }
+            hit.dist = exit;
+            restart(hit);
+            return true;
+        }
+    };
+    
+    RayHit castRayHierarchical(const Map &map, vec2<float> pos, vec2<float> dir, float maxDist)
+    {
+        RayHit hit;
+        RayWalker ray(pos, dir, hit);
+        // smallest block known to have a wall in it. The pyramid isn't looked up again
+        // until the ray leaves it
+        vec2<int> busy(-1, -1);
+        while (!map.isWall(hit.cell.x, hit.cell.y))
+        {
+            // leave the biggest empty block around the cell in one step, unless the ray
+            // ends inside it. Then cell steps finish it like castRay() does
+            if ((hit.cell.x >> Map::BLOCK_SHIFT) != busy.x || (hit.cell.y >> Map::BLOCK_SHIFT) != busy.y)
+            {
+                int level = Map::BLOCK_LEVELS;
+                for (; level > 0; --level)
+                {
+                    int shift = level * Map::BLOCK_SHIFT;
+                    if (!map.isBlockOccupied(level, hit.cell.x >> shift, hit.cell.y >> shift)) break;
+                }
+                if (level == 0)
+                {
+                    busy = vec2<int>(hit.cell.x >> Map::BLOCK_SHIFT, hit.cell.y >> Map::BLOCK_SHIFT);
+                }
+                else
+                {
+                    int shift = level * Map::BLOCK_SHIFT;
+                    vec2<int> first((hit.cell.x >> shift) << shift, (hit.cell.y >> shift) << shift);
+                    if (ray.leaveSquare(first, 1 << shift, maxDist, hit)) continue;
+                }
+            }
+            if (!ray.stepCell(maxDist, hit)) break;
+        }
+        hit.wall = hit.dist < maxDist;
+        hit.u = hitTextureU(hit, pos, dir);
+        return hit;
+    }
+    
+    RayHit castRayDistanceField(const Map &map, vec2<float> pos, vec2<float> dir, float maxDist)
+    {
+        RayHit hit;
+        RayWalker ray(pos, dir, hit);
+        while (!map.isWall(hit.cell.x, hit.cell.y))
+        {
+            // all cells closer than the distance are empty. Right next to walls a cell step
+            // is cheaper than a jump
+            int d = map.distance(hit.cell.x, hit.cell.y);
+            if (d > 2)
+            {
+                vec2<int> first(hit.cell.x - (d - 1), hit.cell.y - (d - 1));
+                if (ray.leaveSquare(first, 2 * d - 1, maxDist, hit)) continue;
+            }
+            if (!ray.stepCell(maxDist, hit)) break;
+        }
+        hit.wall = hit.dist < maxDist;
+        hit.u = hitTextureU(hit, pos, dir);
+        return hit;
+    }
+    
+    void castRaysHierarchical(const Map &map, vec2<float> pos, const float *dirX, const float *dirY,
+                              int count, float maxDist, RayHit *hits)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            hits[i] = castRayHierarchical(map, pos, vec2<float>(dirX[i], dirY[i]), maxDist);
+        }
+    }
+    
+    void castRaysDistanceField(const Map &map, vec2<float> pos, const float *dirX, const float *dirY,
+                               int count, float maxDist, RayHit *hits)
+    {
+        if (!map.hasDistanceField())
+        {
+            castRaysHierarchical(map, pos, dirX, dirY, count, maxDist, hits);
+            return;
+        }
+        for (int i = 0; i < count; ++i)
+        {
+            hits[i] = castRayDistanceField(map, pos, vec2<float>(dirX[i], dirY[i]), maxDist);
+        }
+    }
+    
+    float hitTextureU(const RayHit &hit, vec2<float> pos, vec2<float> dir)
+    {
+        // the face is known from the last step, so u is measured along it relative to the
+        // hit cell. Flip it where needed so the texture isn't mirrored on opposite faces
+        float u;
+        if (hit.side == 0)
+        {
+            u = pos.y + hit.dist * dir.y - hit.cell.y;
+            if (dir.x < 0.f) u = 1.f - u;
+        }
+        else
+        {
+            u = pos.x + hit.dist * dir.x - hit.cell.x;
+            if (dir.y > 0.f) u = 1.f - u;
+        }
+        // rounding can push u slightly out of the cell at the corners
+        return std::min(std::max(u, 0.f), 1.f);
+    }
+    
+    template <>
+    void FrameBuffer::transposeFrom(const FrameBuffer &columns, int rowBegin, int rowEnd)
+    {
+        assert(m_layout == ROW_MAJOR && columns.m_layout == COLUMN_MAJOR);
+        assert(m_width == columns.m_width && m_height == columns.m_height);
+        
+        // 32x32 pixel block is 4KB on each side
+        const int BLOCK = 32;
+        for (int y0 = rowBegin; y0 < rowEnd; y0 += BLOCK)
+        {
+            int y1 = std::min(y0 + BLOCK, rowEnd);
+            for (int x0 = 0; x0 < m_width; x0 += BLOCK)
+            {
+                int x1 = std::min(x0 + BLOCK, m_width);
+                int y = y0;
+#ifdef RAYCASTER_SSE2
+                // 4x4 pixels at a time: four column loads, shuffle, four row stores
+                for (; y + 4 <= y1; y += 4)
+                {
+                    int x = x0;
+                    for (; x + 4 <= x1; x += 4)
+                    {
+                        const core::Pixel *src = columns.m_data + x*columns.m_xStride + y;
+                        __m128i c0 = _mm_loadu_si128((const __m128i*)src);
+                        __m128i c1 = _mm_loadu_si128((const __m128i*)(src + columns.m_xStride));
+                        __m128i c2 = _mm_loadu_si128((const __m128i*)(src + 2*columns.m_xStride));
+                        __m128i c3 = _mm_loadu_si128((const __m128i*)(src + 3*columns.m_xStride));
+                        __m128i t0 = _mm_unpacklo_epi32(c0, c1);
+                        __m128i t1 = _mm_unpacklo_epi32(c2, c3);
+                        __m128i t2 = _mm_unpackhi_epi32(c0, c1);
+                        __m128i t3 = _mm_unpackhi_epi32(c2, c3);
+                        core::Pixel *dst = m_data + y*m_yStride + x;
+                        _mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi64(t0, t1));
+                        _mm_storeu_si128((__m128i*)(dst + m_yStride), _mm_unpackhi_epi64(t0, t1));
+                        _mm_storeu_si128((__m128i*)(dst + 2*m_yStride), _mm_unpacklo_epi64(t2, t3));
+                        _mm_storeu_si128((__m128i*)(dst + 3*m_yStride), _mm_unpackhi_epi64(t2, t3));
+                    }
+                    for (; x < x1; ++x)
+                    {
+                        for (int i = 0; i < 4; ++i)
+                        {
+                            m_data[(y + i)*m_yStride + x] = columns.m_data[x*columns.m_xStride + y + i];
+                        }
+                    }
+                }
+#endif
+                for (; y < y1; ++y)
+                {
+                    core::Pixel *dst = m_data + y*m_yStride;
+                    const core::Pixel *src = columns.m_data + y;
+                    for (int x = x0; x < x1; ++x)
+                    {
+                        dst[x] = src[x*columns.m_xStride];
+                    }
+                }
+            }
+        }
+    }
+    
+    FogTable::FogTable()
+    : ShadeTable(SIDES * LEVELS)
+    {
+        for (int side = 0; side < SIDES; ++side)
+        {
+            for (int level = 0; level < LEVELS; ++level)
+            {
+                // to create "shadow" effect the color is divided by side + 1
+                float mult = (float)level / (LEVELS - 1) / (side + 1);
+                unsigned char *shade = ShadeTable::row(side * LEVELS + level);
+                for (int c = 0; c < ROW_SIZE; ++c)
+                {
+                    shade[c] = (unsigned char)(mult * c);
+                }
+            }
+        }
+    }
+    
+    FogTable::FogTable(const core::Palette &palette)
+    : ShadeTable(SIDES * LEVELS)
+    {
+        // the color of every entry shaded the way the table above does it, then the
+        // closest one the palette has
+        FogTable channels;
+        for (int row = 0; row < SIDES * LEVELS; ++row)
+        {
+            const unsigned char *channel = channels.ShadeTable::row(row);
+            unsigned char *shade = ShadeTable::row(row);
+            for (int i = 0; i < core::Palette::SIZE; ++i)
+            {
+                core::Pixel p = palette.color(i);
+                shade[i] = palette.nearest(core::packPixel(channel[core::pixelRed(p)], channel[core::pixelGreen(p)],
+                                                           channel[core::pixelBlue(p)]));
+            }
+        }
+    }
+    
+    // Texture size known at compile time: the column and row come from shifts and a
+    // mask, and the mask keeps every read in the tile without checks
+    template <int TEX_SHIFT>
+    static void drawWallSpan(const core::Pixel *tile, int, float u, uint32_t v, uint32_t vStep,
+                             const unsigned char *shade, core::Pixel *out, int outStride, int count)
+    {
+        const int SIZE = 1 << TEX_SHIFT;
+        // u == 1 is possible at the far edge of the face
+        int texX = std::min((int)(u * SIZE), SIZE - 1);
+        const core::Pixel *column = tile + (texX << TEX_SHIFT);
+        for (int i = 0; i < count; ++i, v += vStep, out += outStride)
+        {
+            core::Pixel texel = column[(v >> 16) & (SIZE - 1)];
+            *out = core::packPixel(shade[core::pixelRed(texel)],
+                                   shade[core::pixelGreen(texel)],
+                                   shade[core::pixelBlue(texel)]);
+        }
+    }
+    
+    static void drawWallSpanGeneric(const core::Pixel *tile, int texShift, float u, uint32_t v, uint32_t vStep,
+                                    const unsigned char *shade, core::Pixel *out, int outStride, int count)
+    {
+        int size = 1 << texShift;
+        int texX = std::min((int)(u * size), size - 1);
+        const core::Pixel *column = tile + (texX << texShift);
+        for (int i = 0; i < count; ++i, v += vStep, out += outStride)
+        {
+            core::Pixel texel = column[(v >> 16) & (size - 1)];
+            *out = core::packPixel(shade[core::pixelRed(texel)],
+                                   shade[core::pixelGreen(texel)],
+                                   shade[core::pixelBlue(texel)]);
+        }
+    }
+    
+    template <int TEX_SHIFT>
+    static void drawIndexedSpan(const unsigned char *tile, int, float u, uint32_t v, uint32_t vStep,
+                                const unsigned char *shade, unsigned char *out, int outStride, int count)
+    {
+        const int SIZE = 1 << TEX_SHIFT;
+        int texX = std::min((int)(u * SIZE), SIZE - 1);
+        const unsigned char *column = tile + (texX << TEX_SHIFT);
+        for (int i = 0; i < count; ++i, v += vStep, out += outStride)
+        {
+            *out = shade[column[(v >> 16) & (SIZE - 1)]];
+        }
+    }
+    
+    static void drawIndexedSpanGeneric(const unsigned char *tile, int texShift, float u, uint32_t v, uint32_t vStep,
+                                       const unsigned char *shade, unsigned char *out, int outStride, int count)
+    {
+        int size = 1 << texShift;
+        int texX = std::min((int)(u * size), size - 1);
+        const unsigned char *column = tile + (texX << texShift);
+        for (int i = 0; i < count; ++i, v += vStep, out += outStride)
+        {
+            *out = shade[column[(v >> 16) & (size - 1)]];
+        }
+    }
+    
+    WallSpanFunc getWallSpanKernel(int texShift)
+    {
+        switch (texShift)
+        {
+            case 0:
+                return drawWallSpan<0>;
+            case 1:
+                return drawWallSpan<1>;
+            case 2:
+                return drawWallSpan<2>;
+            case 3:
+                return drawWallSpan<3>;
+            case 4:
+                return drawWallSpan<4>;
+            case 5:
+                return drawWallSpan<5>;
+            case 6:
+                return drawWallSpan<6>;
+            case 7:
+                return drawWallSpan<7>;
+            case 8:
+                return drawWallSpan<8>;
+            default:
+                return drawWallSpanGeneric;
+        }
+    }
+    
+    IndexedSpanFunc getIndexedSpanKernel(int texShift)
+    {
+        switch (texShift)
+        {
+            case 0:
+                return drawIndexedSpan<0>;
+            case 1:
+                return drawIndexedSpan<1>;
+            case 2:
+                return drawIndexedSpan<2>;
+            case 3:
+                return drawIndexedSpan<3>;
+            case 4:
+                return drawIndexedSpan<4>;
+            case 5:
+                return drawIndexedSpan<5>;
+            case 6:
+                return drawIndexedSpan<6>;
+            case 7:
+                return drawIndexedSpan<7>;
+            case 8:
+                return drawIndexedSpan<8>;
+            default:
+                return drawIndexedSpanGeneric;
+        }
+    }
+    
+    const core::Pixel Renderer::FLOOR_COLOR = core::packPixel(0x55, 0x55, 0x55);
+    const core::Pixel Renderer::CEILING_COLOR = core::packPixel(0x55, 0x55, 0xff);
+    
+    Renderer::Renderer()
+    : m_wallTextures(nullptr),
+    m_mipmapping(true),
+    m_maxDist(16.f),
+    m_tableWidth(0),
+    m_tableFov(0.f),
+    m_traversal(TRAVERSAL_DDA),
+    m_columnMajor(false),
+    m_floorIndex(0),
+    m_ceilingIndex(0)
+    {
+        setRayKernel(detectRayKernel());
+        std::fill(m_materialTiles, m_materialTiles + 256, 0);
+    }
+    
+    void Renderer::setThreadCount(int count)
+    {
+        m_threadPool.reset(new core::ThreadPool(count));
+    }
+    
+    void Renderer::setWallTextures(const core::TextureAtlas *atlas)
+    {
+        m_wallTextures = atlas;
+        // every tile is of the same size, so one choice per level serves all the materials
+        m_wallSpans.clear();
+        m_indexedSpans.clear();
+        for (int level = 0; atlas && level < atlas->levels(); ++level)
+        {
+            m_wallSpans.push_back(getWallSpanKernel(atlas->tileShift() - level));
+            m_indexedSpans.push_back(getIndexedSpanKernel(atlas->tileShift() - level));
+        }
+        m_indexedTexels.clear();
+    }
+    
+    void Renderer::buildPalette()
+    {
+        assert(m_wallTextures != nullptr && m_wallTextures->tileCount() > 0);
+        const core::TextureAtlas &textures = *m_wallTextures;
+        size_t texels = (size_t)textures.tileCount() << (2 * textures.tileShift() + 1);
+        
+        // every texel of the tiles as bright as it gets and at a few fog levels on
+        // both sides, so there are colors for the far walls too. Floor and ceiling
+        // aren't shaded and get colors of their own
+        const int SAMPLE_LEVELS[] = { FogTable::LEVELS - 1, 3 * FogTable::LEVELS / 4, FogTable::LEVELS / 2,
+                                      FogTable::LEVELS / 4, FogTable::LEVELS / 8 };
+        std::vector<core::Pixel> samples;
+        for (int side = 0; side < FogTable::SIDES; ++side)
+        {
+            for (int level : SAMPLE_LEVELS)
+            {
+                const unsigned char *shade = m_fogTable.ShadeTable::row(side * FogTable::LEVELS + level);
+                for (int i = 0; i < textures.tileCount(); ++i)
+                {
+                    const core::Pixel *tile = textures.tile(i);
+                    for (int t = 0; t < textures.tileSize() * textures.tileSize(); ++t)
+                    {
+                        samples.push_back(core::packPixel(shade[core::pixelRed(tile[t])], shade[core::pixelGreen(tile[t])],
+                                                          shade[core::pixelBlue(tile[t])]));
+                    }
+                }
+            }
+        }
+        std::vector<core::Pixel> fixed = { FLOOR_COLOR, CEILING_COLOR, core::packPixel(0, 0, 0) };
+        m_palette.build(samples, fixed);
+        m_floorIndex = 0;
+        m_ceilingIndex = 1;
+        
+        // every texel, mip levels included, in the atlas's layout
+        m_indexedTexels.resize(texels);
+        for (size_t t = 0; t < texels; ++t)
+        {
+            m_indexedTexels[t] = m_palette.nearest(textures.data()[t]);
+        }
+        m_colormap = FogTable(m_palette);
     }
     
-    int modSgn(int x)
+    void Renderer::setRayKernel(RayKernel kernel)
     {
-        return x > 0 ? 1 : 0;
+        m_rayKernel = std::min(kernel, detectRayKernel());
+        setTraversal(m_traversal);
     }
-    vec2<int> getDeltaBrick(float angle)
+    
+    void Renderer::setTraversal(Traversal traversal)
+    {
+        m_traversal = traversal;
+        switch (traversal)
+        {
+            case TRAVERSAL_HIERARCHICAL:
+                m_castRays = castRaysHierarchical;
+                break;
+            case TRAVERSAL_DISTANCE_FIELD:
+                m_castRays = castRaysDistanceField;
+                break;
+            default:
+                m_castRays = getRayKernel(m_rayKernel);
+                break;
+        }
+    }
+    
+    void Renderer::renderFrame(const Camera &camera, const Map &map, FrameBuffer &frame)
     {
-        angle = convertAngle(angle);
+        FrameBuffer target = frame;
+        if (m_columnMajor)
+        {
+            m_columnBuffer.resize(frame.width() * frame.height());
+            target = FrameBuffer(m_columnBuffer.data(), frame.width(), frame.height(), FrameBuffer::COLUMN_MAJOR);
+        }
+        renderColumns(camera, map, target);
+        if (!m_columnMajor) return;
+        
+        if (!m_threadPool || m_threadPool->threadCount() == 1)
+        {
+            frame.transposeFrom(target, 0, frame.height());
+            return;
+        }
+        // every band of rows needs every column, so only after all tiles are done
+        const int BAND_HEIGHT = 32;
+        int bands = (frame.height() + BAND_HEIGHT - 1) / BAND_HEIGHT;
+        m_threadPool->parallelFor(bands, [&](int band)
+        {
+            frame.transposeFrom(target, band * BAND_HEIGHT, std::min(frame.height(), (band + 1) * BAND_HEIGHT));
+        });
+    }
+    
+    void Renderer::renderFrame(const Camera &camera, const Map &map, IndexedFrameBuffer &frame)
+    {
+        assert(!m_indexedTexels.empty());
+        renderColumns(camera, map, frame);
+    }
+    
+    template <typename P>
+    void Renderer::renderColumns(const Camera &camera, const Map &map, FrameBufferT<P> &frame)
+    {
+        assert(m_wallTextures != nullptr && m_wallTextures->tileCount() > 0);
+        updateColumnTable(frame.width(), camera.fov);
+        
+        int width = frame.width();
+        m_rayDirX.resize(width);
+        m_rayDirY.resize(width);
+        m_hits.resize(width);
         
-        if (angle < M_PI / 2.f)
+        vec2<float> heading(cosf(camera.angle), sinf(camera.angle));
+        if (!m_threadPool || m_threadPool->threadCount() == 1)
         {
-            return vec2<int>(1, 1);
+            renderTile(0, width, heading, camera, map, frame);
+            return;
         }
-        if (angle < M_PI)
+        
+        // near walls cost more to shade than far ones, so there are many more tiles
+        // than threads and idle threads steal the rest. Tiles are a multiple of the
+        // widest ray packet
+        const int TILE_WIDTH = 32;
+        int tiles = (width + TILE_WIDTH - 1) / TILE_WIDTH;
+        m_threadPool->parallelFor(tiles, [&](int tile)
+        {
+            renderTile(tile * TILE_WIDTH, std::min(width, (tile + 1) * TILE_WIDTH), heading, camera, map, frame);
+        });
+    }
+    
+    template <typename P>
+    void Renderer::renderTile(int begin, int end, vec2<float> heading, const Camera &camera, const Map &map, FrameBufferT<P> &frame)
+    {
+        // rotate columns' directions by the camera heading
+        for (int x = begin; x < end; ++x)
         {
-            return vec2<int>(-1, 1);
+            const vec2<float> &offset = m_columnDirs[x];
+            m_rayDirX[x] = heading.x * offset.x - heading.y * offset.y;
+            m_rayDirY[x] = heading.y * offset.x + heading.x * offset.y;
         }
-        if (angle < 3.f*M_PI / 2.f)
+        
+        // trace all the rays first so the kernel can take them in packets
+        m_castRays(map, camera.pos, &m_rayDirX[begin], &m_rayDirY[begin], end - begin, m_maxDist, &m_hits[begin]);
+        for (int x = begin; x < end; ++x)
         {
-            return vec2<int>(-1, -1);
+            shadeColumn(x, m_hits[x], map, frame);
         }
+    }
+    
+    void Renderer::updateColumnTable(int width, float fov)
+    {
+        if (width == m_tableWidth && fov == m_tableFov) return;
         
-        return vec2<int>(1, -1);
+        m_columnDirs.resize(width);
+        for (int x = 0; x < width; ++x)
+        {
+            // [-pov/2; +pov/2]
+            float rayDisplacementAngle = -fov / 2.f + (1.f * x / width) * fov;
+            m_columnDirs[x] = vec2<float>(cosf(rayDisplacementAngle), sinf(rayDisplacementAngle));
+        }
+        m_tableWidth = width;
+        m_tableFov = fov;
     }
-    float convertAngle(float angle)
+    
+    template <typename P>
+    void Renderer::shadeColumn(int x, const RayHit &hit, const Map &map, FrameBufferT<P> &frame) const
     {
-        const float D_PI = M_PI + M_PI;
+        P floorColor, ceilingColor;
+        columnColors(floorColor, ceilingColor);
+        const float MAX_DIST = m_maxDist;
+        const core::TextureAtlas &textures = *m_wallTextures;
+        
+        float wallDist = std::min(MAX_DIST, hit.dist);
+        // the material is only looked at for the cell the ray stopped in
+        int tile = m_materialTiles[map.material(hit.cell.x, hit.cell.y)];
+        
+        // z is a distance to a wall
+        // this line prevents the Fisheye Effect.
+        // Standing right at the wall mustn't make it infinitely tall
+        float z = std::max(wallDist * m_columnDirs[x].x, 1e-3f);
+        int height = frame.height();
+        int floorYBorder = height / 2.f - height / z;
+        int ceilingYBorder = height - floorYBorder;
+        
+        // white near us, black when far, darker on y sides. In palette indices that
+        // is the colormap row of the shade
+        const unsigned char *shade = shadeTable(&floorColor).row(1.f - z / MAX_DIST, hit.side);
         
-        while (angle < 0.f)
+        // rows (floorYBorder; ceilingYBorder) are the wall, clip them to the frame once
+        // so every span below is filled without checks
+        int wallBegin = std::min(std::max(floorYBorder + 1, 0), height);
+        int wallEnd = std::min(std::max(ceilingYBorder, wallBegin), height);
+        
+        // paint the column
+        // GpuRenderer does the same in resources/raycast.frag, keep them in step
+        // floor
+        for (int y = 0; y < wallBegin; ++y)
+        {
+            frame.setPixel(x, y, floorColor);
+        }
+        // wall. Texture v is 16.16 fixed point stepped once per pixel
+        if (wallBegin < wallEnd)
         {
-            angle += D_PI;
+            // the smallest level that still has a texel for every pixel of the wall
+            int wallHeight = ceilingYBorder - floorYBorder;
+            int level = 0;
+            while (m_mipmapping && level + 1 < textures.levels() && (textures.tileSize() >> (level + 1)) >= wallHeight)
+            {
+                ++level;
+            }
+            int texShift = textures.tileShift() - level;
+            uint32_t vStep = ((uint32_t)1 << (texShift + 16)) / wallHeight;
+            // the first row exactly: the truncated step times hundreds of thousands of
+            // clipped rows of a wall right in front of us drifts by many texels
+            uint32_t v = (uint32_t)(((uint64_t)(wallBegin - floorYBorder) << (texShift + 16)) / wallHeight);
+            drawSpan(level, tile, hit.u, v, vStep, shade, &frame.pixel(x, wallBegin), frame.yStride(), wallEnd - wallBegin);
         }
-        while (angle >= D_PI)
+        // ceiling
+        for (int y = wallEnd; y < height; ++y)
         {
-            angle -= D_PI;
+            frame.setPixel(x, y, ceilingColor);
         }
-        return angle;
-    }
+    }
 }
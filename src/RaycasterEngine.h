@@ -1,9 +1,15 @@
 #ifndef RAYCASTER_H
 #define RAYCASTER_H
 
-#include "Texture.h"
+#include "Image.h"
+#include "Map.h"
+#include "Palette.h"
+#include "TextureAtlas.h"
+#include "ThreadPool.h"
 
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <math.h>
 
 namespace raycaster
@@ -98,12 +104,365 @@ namespace raycaster
         return a <= v && v < b;
     }
     
+    // position and orientation of the viewer (angles are in radians)
+    struct Camera
+    {
+        vec2<float> pos;
+        float angle;
+        float fov;
+        
+        Camera(vec2<float> pos = vec2<float>(), float angle = 0.f, float fov = 0.f)
+        : pos(pos), angle(angle), fov(fov)
+        {}
+    };
+    
+    // where a traced ray stopped
+    struct RayHit
+    {
+        // distance along the ray to the last crossed cell border
+        float dist;
+        // cell the ray stopped in
+        vec2<int> cell;
+        // border crossed last: 0 - vertical (x changed), 1 - horizontal (y changed)
+        int side;
+        // false if the ray ran further than maximum distance without hitting a wall
+        bool wall;
+        // horizontal texture coordinate along the hit face, [0; 1]
+        float u;
+    };
+    
+    // implementations of ray tracing, from the slowest to the fastest
+    enum RayKernel
+    {
+        RAY_KERNEL_SCALAR,
+        RAY_KERNEL_SSE41,
+        RAY_KERNEL_AVX2
+    };
+    
+    // how rays walk the map
+    enum Traversal
+    {
+        // cell by cell
+        TRAVERSAL_DDA,
+        // jump over empty blocks of the map's pyramid, cell by cell only near walls.
+        // Always scalar, the packet kernels serve TRAVERSAL_DDA
+        TRAVERSAL_HIERARCHICAL,
+        // jump as far as the map's distance field allows, cell by cell only near walls.
+        // Scalar too. Maps without the field are traced hierarchically
+        TRAVERSAL_DISTANCE_FIELD
+    };
+    
+    // trace count rays from one origin. dirX[i], dirY[i] is normalized direction of i-th ray
+    typedef void (*CastRaysFunc)(const Map &map, vec2<float> pos, const float *dirX, const float *dirY,
+                                 int count, float maxDist, RayHit *hits);
+    
+    // Buffer of pixels the renderer draws into: packed colors (FrameBuffer) or indices
+    // of a palette (IndexedFrameBuffer). Doesn't own the memory
+    template <typename P>
+    class FrameBufferT
+    {
+    public:
+        // ROW_MAJOR is what OpenGL expects. In COLUMN_MAJOR the pixels of a column are
+        // next to each other, which suits drawing column by column
+        enum Layout
+        {
+            ROW_MAJOR,
+            COLUMN_MAJOR
+        };
+    
+    private:
+        P *m_data;
+        int m_width, m_height;
+        Layout m_layout;
+        // pixels between horizontal and vertical neighbours
+        int m_xStride, m_yStride;
+        
+    public:
+        FrameBufferT(P *data, int width, int height, Layout layout = ROW_MAJOR)
+        : m_data(data), m_width(width), m_height(height), m_layout(layout),
+        m_xStride(layout == ROW_MAJOR ? 1 : height),
+        m_yStride(layout == ROW_MAJOR ? width : 1)
+        {}
+        
+        inline int width() const
+        {
+            return m_width;
+        }
+        inline int height() const
+        {
+            return m_height;
+        }
+        inline Layout layout() const
+        {
+            return m_layout;
+        }
+        inline int yStride() const
+        {
+            return m_yStride;
+        }
+        inline P& pixel(int x, int y)
+        {
+            return m_data[y*m_yStride + x*m_xStride];
+        }
+        inline void setPixel(int x, int y, P p)
+        {
+            m_data[y*m_yStride + x*m_xStride] = p;
+        }
+        
+        // copy rows [rowBegin; rowEnd) of a column-major frame of the same size into
+        // this row-major one. Goes in square blocks so both sides stay in cache.
+        // Packed colors only
+        void transposeFrom(const FrameBufferT &columns, int rowBegin, int rowEnd);
+    };
+    typedef FrameBufferT<core::Pixel> FrameBuffer;
+    typedef FrameBufferT<unsigned char> IndexedFrameBuffer;
+    template <>
+    void FrameBuffer::transposeFrom(const FrameBuffer &columns, int rowBegin, int rowEnd);
+    
+    // Rows of 256 entries, each mapping a color channel (or palette index) to its
+    // shaded value. Shading a texel becomes a lookup into the row picked for the
+    // whole column
+    class ShadeTable
+    {
+    public:
+        const static int ROW_SIZE = 256;
+    
+    private:
+        int m_rows;
+        std::vector<unsigned char> m_table;
+    
+    public:
+        explicit ShadeTable(int rows = 0)
+        : m_rows(rows), m_table(rows * ROW_SIZE, 0)
+        {}
+        
+        inline int rows() const
+        {
+            return m_rows;
+        }
+        inline unsigned char* row(int i)
+        {
+            return &m_table[i * ROW_SIZE];
+        }
+        inline const unsigned char* row(int i) const
+        {
+            return &m_table[i * ROW_SIZE];
+        }
+    };
+    
+    // Distance fog and side darkening folded into one ShadeTable: a row per
+    // brightness level for every side
+    class FogTable : public ShadeTable
+    {
+    public:
+        const static int LEVELS = 64;
+        const static int SIDES = 2;
+    
+    public:
+        FogTable();
+        // the same shades of the palette's colors as indices into it, the colormap of
+        // palettized frames: shading an index is an offset to the row of its shade
+        explicit FogTable(const core::Palette &palette);
+        
+        // brightness is in [0; 1], side is RayHit::side
+        inline const unsigned char* row(float brightness, int side) const
+        {
+            int level = (int)(brightness * (LEVELS - 1) + 0.5f);
+            level = std::min(std::max(level, 0), LEVELS - 1);
+            return ShadeTable::row(side * LEVELS + level);
+        }
+    };
+    
+    // Draws count pixels of a wall column, outStride apart, from the texture tile of
+    // 1 << texShift texels squared (column-major). u picks the texture column, v is the
+    // 16.16 texture row of the first pixel, stepped by vStep. Texels are shaded by shade
+    typedef void (*WallSpanFunc)(const core::Pixel *tile, int texShift, float u, uint32_t v, uint32_t vStep,
+                                 const unsigned char *shade, core::Pixel *out, int outStride, int count);
+    // the span function for textures of 1 << texShift texels: specialized for sizes
+    // up to 256, which covers the usual textures and their mip levels, generic above
+    WallSpanFunc getWallSpanKernel(int texShift);
+    // the same for palettized frames: texels are palette indices, shade is a colormap row
+    typedef void (*IndexedSpanFunc)(const unsigned char *tile, int texShift, float u, uint32_t v, uint32_t vStep,
+                                    const unsigned char *shade, unsigned char *out, int outStride, int count);
+    IndexedSpanFunc getIndexedSpanKernel(int texShift);
+    
+    // draws the world as seen by the camera. Knows nothing about windows or OpenGL,
+    // so it can be driven by the game loop as well as by a benchmark
+    class Renderer
+    {
+    public:
+        static const core::Pixel FLOOR_COLOR;
+        static const core::Pixel CEILING_COLOR;
+    
+    private:
+        const core::TextureAtlas *m_wallTextures;
+        // span function of every mip level
+        std::vector<WallSpanFunc> m_wallSpans;
+        std::vector<IndexedSpanFunc> m_indexedSpans;
+        bool m_mipmapping;
+        // atlas tile of every material
+        int m_materialTiles[256];
+        float m_maxDist;
+        // direction of every column's ray relative to the view direction: (cos, sin) of
+        // the column's angular offset. Its x is also the fisheye correction factor
+        std::vector<vec2<float>> m_columnDirs;
+        // frame width and field of view the column table was built for
+        int m_tableWidth;
+        float m_tableFov;
+        // this frame's ray of every column, rotated by the camera heading
+        std::vector<float> m_rayDirX, m_rayDirY;
+        std::vector<RayHit> m_hits;
+        RayKernel m_rayKernel;
+        Traversal m_traversal;
+        CastRaysFunc m_castRays;
+        std::unique_ptr<core::ThreadPool> m_threadPool;
+        // frame drawn column by column, transposed into the target frame at the end
+        bool m_columnMajor;
+        std::vector<core::Pixel> m_columnBuffer;
+        FogTable m_fogTable;
+        // palettized frames: the atlas as indices of the palette, laid out the same
+        core::Palette m_palette;
+        std::vector<unsigned char> m_indexedTexels;
+        FogTable m_colormap;
+        unsigned char m_floorIndex, m_ceilingIndex;
+        
+    public:
+        Renderer();
+        
+        // textures of the walls. Must outlive the renderer. Every material shows
+        // tile 0 until told otherwise
+        void setWallTextures(const core::TextureAtlas *atlas);
+        inline void setMaterialTexture(unsigned char material, int tile)
+        {
+            m_materialTiles[material] = tile;
+        }
+        // sample far walls from smaller mip levels, so they don't shimmer and take less
+        // cache. On by default
+        inline void setMipmapping(bool mipmapping)
+        {
+            m_mipmapping = mipmapping;
+        }
+        inline bool mipmapping() const
+        {
+            return m_mipmapping;
+        }
+        // rays are not traced further than this distance
+        inline void setMaxDistance(float dist)
+        {
+            m_maxDist = dist;
+        }
+        inline float maxDistance() const
+        {
+            return m_maxDist;
+        }
+        // by default the fastest kernel supported by the CPU is used.
+        // Falls back to a slower one if the requested isn't supported
+        void setRayKernel(RayKernel kernel);
+        inline RayKernel rayKernel() const
+        {
+            return m_rayKernel;
+        }
+        // TRAVERSAL_DDA by default. The jumping ones pay off on open maps with long view
+        // distance, near walls they are slower
+        void setTraversal(Traversal traversal);
+        inline Traversal traversal() const
+        {
+            return m_traversal;
+        }
+        // columns are rendered in tiles spread over this many threads (including the
+        // caller's). 0 means one per hardware thread. The image doesn't depend on it
+        void setThreadCount(int count);
+        inline int threadCount() const
+        {
+            return m_threadPool ? m_threadPool->threadCount() : 1;
+        }
+        // draw into an internal column-major frame so every column is written
+        // sequentially, then transpose it into the row-major target frame
+        inline void setColumnMajor(bool columnMajor)
+        {
+            m_columnMajor = columnMajor;
+        }
+        inline bool columnMajor() const
+        {
+            return m_columnMajor;
+        }
+        // Get ready for palettized frames: pick 256 colors for the wall textures as the
+        // fog shades them, with floor and ceiling, and turn the textures and the fog
+        // into indices of them. Call once the atlas has all its tiles
+        void buildPalette();
+        inline const core::Palette& palette() const
+        {
+            return m_palette;
+        }
+        
+        // raycast and shade every column of the frame. All the threads are done with
+        // the frame when it returns
+        void renderFrame(const Camera &camera, const Map &map, FrameBuffer &frame);
+        // the same in palette indices, a quarter of the stores and of the upload. Needs
+        // buildPalette(). Always drawn in place, a byte per column is cheap to scatter
+        void renderFrame(const Camera &camera, const Map &map, IndexedFrameBuffer &frame);
+        
+    private:
+        // rebuild column table if width or fov changed since the last frame
+        void updateColumnTable(int width, float fov);
+        // trace and shade every column, in tiles over the threads
+        template <typename P>
+        void renderColumns(const Camera &camera, const Map &map, FrameBufferT<P> &frame);
+        // columns [begin; end). heading is (cos, sin) of the camera angle
+        template <typename P>
+        void renderTile(int begin, int end, vec2<float> heading, const Camera &camera, const Map &map, FrameBufferT<P> &frame);
+        template <typename P>
+        void shadeColumn(int x, const RayHit &hit, const Map &map, FrameBufferT<P> &frame) const;
+        // the parts of shadeColumn() that depend on the kind of frame
+        inline void columnColors(core::Pixel &floor, core::Pixel &ceiling) const
+        {
+            floor = FLOOR_COLOR;
+            ceiling = CEILING_COLOR;
+        }
+        inline void columnColors(unsigned char &floor, unsigned char &ceiling) const
+        {
+            floor = m_floorIndex;
+            ceiling = m_ceilingIndex;
+        }
+        inline const FogTable& shadeTable(const core::Pixel*) const
+        {
+            return m_fogTable;
+        }
+        inline const FogTable& shadeTable(const unsigned char*) const
+        {
+            return m_colormap;
+        }
+        inline void drawSpan(int level, int tile, float u, uint32_t v, uint32_t vStep, const unsigned char *shade,
+                             core::Pixel *out, int outStride, int count) const
+        {
+            m_wallSpans[level](m_wallTextures->tile(tile, level), m_wallTextures->tileShift() - level,
+                               u, v, vStep, shade, out, outStride, count);
+        }
+        inline void drawSpan(int level, int tile, float u, uint32_t v, uint32_t vStep, const unsigned char *shade,
+                             unsigned char *out, int outStride, int count) const
+        {
+            const core::Pixel *texels = m_wallTextures->tile(tile, level);
+            m_indexedSpans[level](&m_indexedTexels[texels - m_wallTextures->data()], m_wallTextures->tileShift() - level,
+                                  u, v, vStep, shade, out, outStride, count);
+        }
+    };
+    
     float getFraction(float n);
     vec2<float> getFraction(vec2<float> v);
-    int getOctant(float angle);
-    int modSgn(int x);
-    vec2<int> getDeltaBrick(float angle);
-    float convertAngle(float angle);
+    
+    // trace the ray from pos along normalized dir cell by cell (DDA)
+    RayHit castRay(const Map &map, vec2<float> pos, vec2<float> dir, float maxDist);
+    // same, but skipping empty blocks. Hits the same cells as castRay(), distances
+    // may differ in the last bits
+    RayHit castRayHierarchical(const Map &map, vec2<float> pos, vec2<float> dir, float maxDist);
+    void castRaysHierarchical(const Map &map, vec2<float> pos, const float *dirX, const float *dirY,
+                              int count, float maxDist, RayHit *hits);
+    // same again, jumping by the distance field. The map must have one
+    RayHit castRayDistanceField(const Map &map, vec2<float> pos, vec2<float> dir, float maxDist);
+    void castRaysDistanceField(const Map &map, vec2<float> pos, const float *dirX, const float *dirY,
+                               int count, float maxDist, RayHit *hits);
+    // texture u of the hit ray, see RayHit::u
+    float hitTextureU(const RayHit &hit, vec2<float> pos, vec2<float> dir);
 }
 
 #endif
@@ -0,0 +1,362 @@
+#include "RaycasterSimd.h"
+
+#include <limits.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RAYCASTER_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// Kernels are compiled for their instruction set per function, not per file, so the
+// inline functions from headers they use are never emitted with AVX2 instructions
+// and picked by the linker for code that runs on older CPUs
+#if defined(_MSC_VER)
+#define RAYCASTER_TARGET(isa)
+#else
+#define RAYCASTER_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+namespace raycaster
+{
+    void castRaysScalar(const Map &map, vec2<float> pos, const float *dirX, const float *dirY,
+                        int count, float maxDist, RayHit *hits)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            hits[i] = castRay(map, pos, vec2<float>(dirX[i], dirY[i]), maxDist);
+        }
+    }
+
+#ifdef RAYCASTER_X86
+    
+    static void cpuid(int info[4], int leaf)
+    {
+#if defined(_MSC_VER)
+        __cpuidex(info, leaf, 0);
+#else
+        __cpuid_count(leaf, 0, info[0], info[1], info[2], info[3]);
+#endif
+    }
+    
+    // which register states the OS saves on context switch
+    static unsigned long long xgetbv0()
+    {
+#if defined(_MSC_VER)
+        return _xgetbv(0);
+#else
+        unsigned int eax, edx;
+        __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        return ((unsigned long long)edx << 32) | eax;
+#endif
+    }
+    
+    static RayKernel queryRayKernel()
+    {
+        int info[4];
+        cpuid(info, 0);
+        int maxLeaf = info[0];
+        if (maxLeaf < 1) return RAY_KERNEL_SCALAR;
+        
+        cpuid(info, 1);
+        bool sse41 = (info[2] & (1 << 19)) != 0;
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        if (!sse41) return RAY_KERNEL_SCALAR;
+        
+        // AVX2 needs the CPU flag and the OS to preserve YMM registers
+        if (maxLeaf >= 7 && osxsave && avx && (xgetbv0() & 0x6) == 0x6)
+        {
+            cpuid(info, 7);
+            if (info[1] & (1 << 5)) return RAY_KERNEL_AVX2;
+        }
+        return RAY_KERNEL_SSE41;
+    }
+    
+    RAYCASTER_TARGET("sse4.1")
+    void castRaysSse41(const Map &map, vec2<float> pos, const float *dirX, const float *dirY,
+                       int count, float maxDist, RayHit *hits)
+    {
+        const vec2<int> cell(floorf(pos.x), floorf(pos.y));
+        // if the origin is inside a wall every ray stops at once, leave it to the scalar loop
+        const int packed = map.isWall(cell.x, cell.y) ? 0 : count - count % 4;
+        
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.f);
+        const __m128 inf = _mm_set1_ps(INFINITY);
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        const __m128 maxDist4 = _mm_set1_ps(maxDist);
+        const __m128i laneBits = _mm_setr_epi32(1, 2, 4, 8);
+        // distance to the first border along each axis, before scaling by deltaDist
+        const __m128 toNextX = _mm_set1_ps(cell.x + 1.f - pos.x);
+        const __m128 toNextY = _mm_set1_ps(cell.y + 1.f - pos.y);
+        const __m128 toPrevX = _mm_set1_ps(pos.x - cell.x);
+        const __m128 toPrevY = _mm_set1_ps(pos.y - cell.y);
+        
+        for (int i = 0; i < packed; i += 4)
+        {
+            __m128 dx = _mm_loadu_ps(dirX + i);
+            __m128 dy = _mm_loadu_ps(dirY + i);
+            __m128 negX = _mm_cmplt_ps(dx, zero);
+            __m128 negY = _mm_cmplt_ps(dy, zero);
+            __m128 zeroX = _mm_cmpeq_ps(dx, zero);
+            __m128 zeroY = _mm_cmpeq_ps(dy, zero);
+            
+            __m128 deltaX = _mm_blendv_ps(_mm_and_ps(_mm_div_ps(one, dx), absMask), inf, zeroX);
+            __m128 deltaY = _mm_blendv_ps(_mm_and_ps(_mm_div_ps(one, dy), absMask), inf, zeroY);
+            __m128 sideX = _mm_blendv_ps(_mm_mul_ps(_mm_blendv_ps(toNextX, toPrevX, negX), deltaX), inf, zeroX);
+            __m128 sideY = _mm_blendv_ps(_mm_mul_ps(_mm_blendv_ps(toNextY, toPrevY, negY), deltaY), inf, zeroY);
+            // -1 where direction is negative, 1 elsewhere
+            __m128i stepX = _mm_or_si128(_mm_castps_si128(negX), _mm_set1_epi32(1));
+            __m128i stepY = _mm_or_si128(_mm_castps_si128(negY), _mm_set1_epi32(1));
+            
+            __m128i cellX = _mm_set1_epi32(cell.x);
+            __m128i cellY = _mm_set1_epi32(cell.y);
+            __m128 side = zero;
+            __m128 dist = zero;
+            __m128 active = _mm_castsi128_ps(_mm_cmpeq_epi32(cellX, cellX));
+            
+            for (;;)
+            {
+                __m128 takeX = _mm_cmplt_ps(sideX, sideY);
+                __m128 next = _mm_blendv_ps(sideY, sideX, takeX);
+                dist = _mm_blendv_ps(dist, next, active);
+                
+                // rays that would cross the border beyond maximum distance stop where they are
+                __m128 move = _mm_andnot_ps(_mm_cmpge_ps(next, maxDist4), active);
+                __m128 moveX = _mm_and_ps(move, takeX);
+                __m128 moveY = _mm_andnot_ps(takeX, move);
+                sideX = _mm_add_ps(sideX, _mm_and_ps(deltaX, moveX));
+                sideY = _mm_add_ps(sideY, _mm_and_ps(deltaY, moveY));
+                cellX = _mm_add_epi32(cellX, _mm_and_si128(stepX, _mm_castps_si128(moveX)));
+                cellY = _mm_add_epi32(cellY, _mm_and_si128(stepY, _mm_castps_si128(moveY)));
+                side = _mm_blendv_ps(side, zero, moveX);
+                side = _mm_blendv_ps(side, _mm_castsi128_ps(_mm_set1_epi32(1)), moveY);
+                
+                int activeBits = _mm_movemask_ps(move);
+                if (activeBits == 0) break;
+                
+                // look up the cells of all rays one by one. Stopped rays are looked up again,
+                // which is harmless, so no need to branch on the mask here
+                alignas(16) int x[4], y[4];
+                _mm_store_si128((__m128i*)x, cellX);
+                _mm_store_si128((__m128i*)y, cellY);
+                int wallBits = 0;
+                for (int l = 0; l < 4; ++l)
+                {
+                    wallBits |= map.isWall(x[l], y[l]) << l;
+                }
+                activeBits &= ~wallBits;
+                __m128i bits = _mm_and_si128(_mm_set1_epi32(activeBits), laneBits);
+                active = _mm_castsi128_ps(_mm_cmpeq_epi32(bits, laneBits));
+            }
+            
+            alignas(16) float d[4];
+            alignas(16) int x[4], y[4], s[4];
+            _mm_store_ps(d, dist);
+            _mm_store_si128((__m128i*)x, cellX);
+            _mm_store_si128((__m128i*)y, cellY);
+            _mm_store_si128((__m128i*)s, _mm_castps_si128(side));
+            for (int l = 0; l < 4; ++l)
+            {
+                RayHit &hit = hits[i + l];
+                hit.dist = d[l];
+                hit.cell = vec2<int>(x[l], y[l]);
+                hit.side = s[l];
+                hit.wall = hit.dist < maxDist;
+                hit.u = hitTextureU(hit, pos, vec2<float>(dirX[i + l], dirY[i + l]));
+            }
+        }
+        castRaysScalar(map, pos, dirX + packed, dirY + packed, count - packed, maxDist, hits + packed);
+    }
+    
+    RAYCASTER_TARGET("avx2")
+    void castRaysAvx2(const Map &map, vec2<float> pos, const float *dirX, const float *dirY,
+                      int count, float maxDist, RayHit *hits)
+    {
+        const vec2<int> cell(floorf(pos.x), floorf(pos.y));
+        // if the origin is inside a wall every ray stops at once, leave it to the scalar loop
+        const int packed = map.isWall(cell.x, cell.y) ? 0 : count - count % 8;
+        
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.f);
+        const __m256 inf = _mm256_set1_ps(INFINITY);
+        const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+        const __m256 maxDist8 = _mm256_set1_ps(maxDist);
+        const __m256i laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+        // occupancy plane seen as 32 bit words (little endian, so the low half of a
+        // 64 bit word comes first). Sizes have the sign bit flipped to compare unsigned
+        const int *occupancy = (const int*)map.occupancy();
+        const bool tiled = map.layout() == Map::TILED;
+        const bool chunked = map.layout() == Map::CHUNKED;
+        const int *mortonX = (const int*)map.mortonX();
+        const int *mortonY = (const int*)map.mortonY();
+        const __m256i halvesPerRow = _mm256_set1_epi32(map.wordsPerRow() * 2);
+        const __m256i signBit = _mm256_set1_epi32(INT_MIN);
+        const __m256i mapWidth = _mm256_set1_epi32(map.width() ^ INT_MIN);
+        const __m256i mapHeight = _mm256_set1_epi32(map.height() ^ INT_MIN);
+        const __m256i allBits = _mm256_set1_epi32(-1);
+        const __m256i zeroBits = _mm256_setzero_si256();
+        const __m256i bitMask = _mm256_set1_epi32(31);
+        const __m256i oneBit = _mm256_set1_epi32(1);
+        // distance to the first border along each axis, before scaling by deltaDist
+        const __m256 toNextX = _mm256_set1_ps(cell.x + 1.f - pos.x);
+        const __m256 toNextY = _mm256_set1_ps(cell.y + 1.f - pos.y);
+        const __m256 toPrevX = _mm256_set1_ps(pos.x - cell.x);
+        const __m256 toPrevY = _mm256_set1_ps(pos.y - cell.y);
+        
+        for (int i = 0; i < packed; i += 8)
+        {
+            __m256 dx = _mm256_loadu_ps(dirX + i);
+            __m256 dy = _mm256_loadu_ps(dirY + i);
+            __m256 negX = _mm256_cmp_ps(dx, zero, _CMP_LT_OQ);
+            __m256 negY = _mm256_cmp_ps(dy, zero, _CMP_LT_OQ);
+            __m256 zeroX = _mm256_cmp_ps(dx, zero, _CMP_EQ_OQ);
+            __m256 zeroY = _mm256_cmp_ps(dy, zero, _CMP_EQ_OQ);
+            
+            __m256 deltaX = _mm256_blendv_ps(_mm256_and_ps(_mm256_div_ps(one, dx), absMask), inf, zeroX);
+            __m256 deltaY = _mm256_blendv_ps(_mm256_and_ps(_mm256_div_ps(one, dy), absMask), inf, zeroY);
+            __m256 sideX = _mm256_blendv_ps(_mm256_mul_ps(_mm256_blendv_ps(toNextX, toPrevX, negX), deltaX), inf, zeroX);
+            __m256 sideY = _mm256_blendv_ps(_mm256_mul_ps(_mm256_blendv_ps(toNextY, toPrevY, negY), deltaY), inf, zeroY);
+            // -1 where direction is negative, 1 elsewhere
+            __m256i stepX = _mm256_or_si256(_mm256_castps_si256(negX), _mm256_set1_epi32(1));
+            __m256i stepY = _mm256_or_si256(_mm256_castps_si256(negY), _mm256_set1_epi32(1));
+            
+            __m256i cellX = _mm256_set1_epi32(cell.x);
+            __m256i cellY = _mm256_set1_epi32(cell.y);
+            __m256 side = zero;
+            __m256 dist = zero;
+            __m256 active = _mm256_castsi256_ps(_mm256_cmpeq_epi32(cellX, cellX));
+            
+            for (;;)
+            {
+                __m256 takeX = _mm256_cmp_ps(sideX, sideY, _CMP_LT_OQ);
+                __m256 next = _mm256_blendv_ps(sideY, sideX, takeX);
+                dist = _mm256_blendv_ps(dist, next, active);
+                
+                // rays that would cross the border beyond maximum distance stop where they are
+                __m256 move = _mm256_andnot_ps(_mm256_cmp_ps(next, maxDist8, _CMP_GE_OQ), active);
+                __m256 moveX = _mm256_and_ps(move, takeX);
+                __m256 moveY = _mm256_andnot_ps(takeX, move);
+                sideX = _mm256_add_ps(sideX, _mm256_and_ps(deltaX, moveX));
+                sideY = _mm256_add_ps(sideY, _mm256_and_ps(deltaY, moveY));
+                cellX = _mm256_add_epi32(cellX, _mm256_and_si256(stepX, _mm256_castps_si256(moveX)));
+                cellY = _mm256_add_epi32(cellY, _mm256_and_si256(stepY, _mm256_castps_si256(moveY)));
+                side = _mm256_blendv_ps(side, zero, moveX);
+                side = _mm256_blendv_ps(side, _mm256_castsi256_ps(_mm256_set1_epi32(1)), moveY);
+                
+                int activeBits = _mm256_movemask_ps(move);
+                if (activeBits == 0) break;
+                
+                int wallBits = 0;
+                if (chunked)
+                {
+                    // chunk pointers don't gather well, look the cells up one by one
+                    alignas(32) int x[8], y[8];
+                    _mm256_store_si256((__m256i*)x, cellX);
+                    _mm256_store_si256((__m256i*)y, cellY);
+                    for (int l = 0; l < 8; ++l)
+                    {
+                        wallBits |= map.isWall(x[l], y[l]) << l;
+                    }
+                }
+                else
+                {
+                    // gather the 32 bit halves of occupancy words holding the cells. Lanes
+                    // outside the map aren't loaded and keep all bits set, they are walls
+                    __m256i inside = _mm256_and_si256(_mm256_cmpgt_epi32(mapWidth, _mm256_xor_si256(cellX, signBit)),
+                                                      _mm256_cmpgt_epi32(mapHeight, _mm256_xor_si256(cellY, signBit)));
+                    __m256i index, shift;
+                    if (tiled)
+                    {
+                        // word from the Morton tables, then bit (y & 7) * 8 + (x & 7) of it:
+                        // half (y >> 2) & 1, bit ((y & 3) << 3) | (x & 7) in the half
+                        __m256i tileX = _mm256_srai_epi32(cellX, Map::TILE_SHIFT);
+                        __m256i tileY = _mm256_srai_epi32(cellY, Map::TILE_SHIFT);
+                        __m256i word = _mm256_add_epi32(_mm256_mask_i32gather_epi32(zeroBits, mortonX, tileX, inside, 4),
+                                                        _mm256_mask_i32gather_epi32(zeroBits, mortonY, tileY, inside, 4));
+                        index = _mm256_or_si256(_mm256_slli_epi32(word, 1), _mm256_and_si256(_mm256_srai_epi32(cellY, 2), oneBit));
+                        shift = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(cellY, _mm256_set1_epi32(3)), 3),
+                                                _mm256_and_si256(cellX, _mm256_set1_epi32(7)));
+                    }
+                    else
+                    {
+                        index = _mm256_add_epi32(_mm256_mullo_epi32(cellY, halvesPerRow), _mm256_srai_epi32(cellX, 5));
+                        shift = _mm256_and_si256(cellX, bitMask);
+                    }
+                    __m256i half = _mm256_mask_i32gather_epi32(allBits, occupancy, index, inside, 4);
+                    __m256i wall = _mm256_and_si256(_mm256_srlv_epi32(half, shift), oneBit);
+                    wallBits = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(wall, oneBit)));
+                }
+                activeBits &= ~wallBits;
+                __m256i bits = _mm256_and_si256(_mm256_set1_epi32(activeBits), laneBits);
+                active = _mm256_castsi256_ps(_mm256_cmpeq_epi32(bits, laneBits));
+            }
+            
+            alignas(32) float d[8];
+            alignas(32) int x[8], y[8], s[8];
+            _mm256_store_ps(d, dist);
+            _mm256_store_si256((__m256i*)x, cellX);
+            _mm256_store_si256((__m256i*)y, cellY);
+            _mm256_store_si256((__m256i*)s, _mm256_castps_si256(side));
+            for (int l = 0; l < 8; ++l)
+            {
+                RayHit &hit = hits[i + l];
+                hit.dist = d[l];
+                hit.cell = vec2<int>(x[l], y[l]);
+                hit.side = s[l];
+                hit.wall = hit.dist < maxDist;
+                hit.u = hitTextureU(hit, pos, vec2<float>(dirX[i + l], dirY[i + l]));
+            }
+        }
+        castRaysScalar(map, pos, dirX + packed, dirY + packed, count - packed, maxDist, hits + packed);
+    }
+
+#else
+    
+    static RayKernel queryRayKernel()
+    {
+        return RAY_KERNEL_SCALAR;
+    }
+
+#endif
+    
+    RayKernel detectRayKernel()
+    {
+        static const RayKernel kernel = queryRayKernel();
+        return kernel;
+    }
+    
+    CastRaysFunc getRayKernel(RayKernel kernel)
+    {
+#ifdef RAYCASTER_X86
+        switch (kernel)
+        {
+            case RAY_KERNEL_AVX2:
+                return castRaysAvx2;
+            case RAY_KERNEL_SSE41:
+                return castRaysSse41;
+            default:
+                break;
+        }
+#endif
+        return castRaysScalar;
+    }
+    
+    const char* rayKernelName(RayKernel kernel)
+    {
+        switch (kernel)
+        {
+            case RAY_KERNEL_AVX2:
+                return "AVX2";
+            case RAY_KERNEL_SSE41:
+                return "SSE4.1";
+            default:
+                return "scalar";
+        }
+    }
+}
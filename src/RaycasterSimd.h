@@ -0,0 +1,24 @@
+#ifndef RAYCASTER_SIMD_H
+#define RAYCASTER_SIMD_H
+
+#include "RaycasterEngine.h"
+
+namespace raycaster
+{
+    // All kernels produce exactly the same hits as castRay() for every ray.
+    // Packet kernels step 4 or 8 adjacent rays at once and keep a mask of the rays
+    // that are still travelling; the packet is done when the mask is empty
+    void castRaysScalar(const Map &map, vec2<float> pos, const float *dirX, const float *dirY,
+                        int count, float maxDist, RayHit *hits);
+    void castRaysSse41(const Map &map, vec2<float> pos, const float *dirX, const float *dirY,
+                       int count, float maxDist, RayHit *hits);
+    void castRaysAvx2(const Map &map, vec2<float> pos, const float *dirX, const float *dirY,
+                      int count, float maxDist, RayHit *hits);
+    
+    // fastest kernel supported by the CPU (checked with CPUID once)
+    RayKernel detectRayKernel();
+    CastRaysFunc getRayKernel(RayKernel kernel);
+    const char* rayKernelName(RayKernel kernel);
+}
+
+#endif
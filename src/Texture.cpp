@@ -1,45 +1,23 @@
 #include "Texture.h"
 
 #include "string.h"
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
-#include "spdlog/spdlog.h"
+#include "spdlog/spdlog.h"
 namespace core
 {
-    ImageBase::ImageBase()
-    : m_width(0),
-    m_height(0),
-    m_colors(0),
-    m_data(nullptr)
-    {}
-    
-    Image::~Image()
-    {
-        dispose();
-    }
-    void Image::loadFromFile(const char *file)
-    {
-        assert(m_data == nullptr);
-        m_data = stbi_load(file, &m_width, &m_height, &m_colors, 0);
-        assert(m_data != nullptr);
-        spdlog::get("console")->info("Image \"{0}\" {1}x{2}x{3} loaded successfully", file, m_width, m_height, m_colors);
-    }
-    void Image::dispose()
-    {
-        if (m_data)
-        {
-            stbi_image_free(m_data);
-            m_width = m_height = m_colors = 0;
-            m_data = nullptr;
-        }
-    }
-    
-    
     Texture::Texture()
     : core::ImageBase(),
-    m_glTex(0)
+    m_glTex(0),
+    m_storage(STORAGE_HEAP),
+    m_format(FORMAT_BGRA),
+    m_nextPbo(0),
+    m_heap(nullptr),
+    m_persistent(nullptr)
     {
-        m_colors = COLORS;
+        for (int i = 0; i < PBO_COUNT; ++i)
+        {
+            m_pbos[i] = 0;
+            m_fences[i] = nullptr;
+        }
     }
     
     Texture::~Texture()
@@ -49,22 +27,41 @@ namespace core
     
     void Texture::dispose()
     {
-        if (m_data != nullptr)
+        if (m_heap != nullptr)
         {
-            delete[] m_data;
-            m_width = m_height = 0;
-            m_data = nullptr;
+            delete[] m_heap;
+            m_heap = nullptr;
+        }
+        for (int i = 0; i < PBO_COUNT; ++i)
+        {
+            if (m_fences[i])
+            {
+                glDeleteSync(m_fences[i]);
+                m_fences[i] = nullptr;
+            }
+        }
+        if (m_pbos[0] != 0)
+        {
+            // a mapped buffer is unmapped when it is deleted
+            glDeleteBuffers(PBO_COUNT, m_pbos);
+            for (int i = 0; i < PBO_COUNT; ++i)
+            {
+                m_pbos[i] = 0;
+            }
         }
         if (m_glTex != 0)
         {
             glDeleteTextures(1, &m_glTex);
             m_glTex = 0;
         }
+        m_width = m_height = 0;
+        m_data = nullptr;
+        m_persistent = nullptr;
     }
     
     // create OpenGL texture and fill it with black color
     
-    void Texture::createGlTexture(int width, int height)
+    void Texture::createGlTexture(int width, int height, Storage preferred, Format format)
     {
         // make sure everything is deleted prior to this call
         assert(m_glTex == 0);
@@ -75,6 +72,7 @@ namespace core
         // assign new width and height
         m_width = width;
         m_height = height;
+        m_format = format;
         
         glGenTextures(1, &m_glTex);
         bindTexture();
@@ -82,9 +80,50 @@ namespace core
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        // the only level there is, storage for it is never allocated again
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        GLenum internalFormat = m_format == FORMAT_INDEXED ? GL_R8 : GL_RGBA8;
+        if (GLAD_GL_ARB_texture_storage)
+        {
+            glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, m_width, m_height);
+        }
+        else
+        {
+            glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, m_width, m_height, 0, pixelFormat(), pixelType(), nullptr);
+        }
+        
+        size_t size = frameBytes();
+        glGenBuffers(PBO_COUNT, m_pbos);
+        m_storage = preferred == STORAGE_PERSISTENT && !GLAD_GL_ARB_buffer_storage ? STORAGE_MAPPED : preferred;
+        if (m_storage == STORAGE_PERSISTENT)
+        {
+            // one buffer holds the whole ring, so there is one mapping for good
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbos[0]);
+            glBufferStorage(GL_PIXEL_UNPACK_BUFFER, PBO_COUNT * size, nullptr, flags);
+            m_persistent = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, PBO_COUNT * size, flags);
+            if (!m_persistent)
+            {
+                // start again with new buffers, the storage of this one is immutable
+                glDeleteBuffers(PBO_COUNT, m_pbos);
+                glGenBuffers(PBO_COUNT, m_pbos);
+                m_storage = STORAGE_MAPPED;
+            }
+        }
+        if (m_storage != STORAGE_PERSISTENT)
+        {
+            for (int i = 0; i < PBO_COUNT; ++i)
+            {
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbos[i]);
+                glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+            }
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        
+        if (m_storage == STORAGE_HEAP) useHeap();
+        beginFrame(m_nextPbo);
         
         // clear texture data and load it into VRAM (VIDEO CARD RAM)
-        m_data = new GLubyte[m_width*m_height*COLORS];
         clearTexture();
         loadToVRAM();
     }
@@ -92,14 +131,136 @@ namespace core
     // fill local buffer with black color
     void Texture::clearTexture() const
     {
-        memset(m_data, 0, m_width * m_height * m_colors);
+        memset(m_data, 0, frameBytes());
+    }
+    
+    void Texture::waitForPbo(int i)
+    {
+        if (m_fences[i])
+        {
+            glClientWaitSync(m_fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            glDeleteSync(m_fences[i]);
+            m_fences[i] = nullptr;
+        }
+    }
+    
+    void Texture::beginFrame(int i)
+    {
+        size_t size = frameBytes();
+        switch (m_storage)
+        {
+            case STORAGE_PERSISTENT:
+                waitForPbo(i);
+                m_data = (Pixel*)(m_persistent + i * size);
+                break;
+            case STORAGE_MAPPED:
+                waitForPbo(i);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbos[i]);
+                // the fence says the buffer is free, the driver needn't check again
+                m_data = (Pixel*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                                  GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                if (!m_data)
+                {
+                    spdlog::get("console")->warn("Texture: pixel buffer can't be mapped, frames go through the heap now");
+                    useHeap();
+                }
+                break;
+            default:
+                m_data = m_heap;
+                break;
+        }
+    }
+    
+    void Texture::useHeap()
+    {
+        m_storage = STORAGE_HEAP;
+        if (!m_heap)
+        {
+            size_t size = frameBytes();
+            m_heap = new Pixel[(size + sizeof(Pixel) - 1) / sizeof(Pixel)];
+        }
+        m_data = m_heap;
     }
     
     // load from local buffer to Video card RAM
     
-    void Texture::loadToVRAM() const
+    void Texture::loadToVRAM()
+    {
+        size_t size = frameBytes();
+        int i = m_nextPbo;
+        m_nextPbo = (m_nextPbo + 1) % PBO_COUNT;
+        
+        // the pixels of the texture in the bound buffer
+        const void *offset = nullptr;
+        bool buffered = true;
+        // pixels to upload straight from memory when they couldn't go through a buffer
+        const void *direct = nullptr;
+        switch (m_storage)
+        {
+            case STORAGE_PERSISTENT:
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbos[0]);
+                offset = (const void*)(i * size);
+                break;
+            case STORAGE_MAPPED:
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbos[i]);
+                buffered = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE;
+                if (!buffered)
+                {
+                    // the buffer got corrupted (e.g. a mode switch) and this frame with
+                    // it, the texture keeps the last one. The heap can't get corrupted
+                    spdlog::get("console")->warn("Texture: pixel buffer lost a frame, frames go through the heap now");
+                    useHeap();
+                }
+                break;
+            default:
+            {
+                // the upload of PBO_COUNT frames ago may still read this buffer
+                waitForPbo(i);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbos[i]);
+                void *pixels = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+                buffered = pixels != nullptr;
+                if (buffered)
+                {
+                    memcpy(pixels, m_data, size);
+                    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                }
+                else
+                {
+                    // mapping can fail (out of memory, lost context), upload the slow way
+                    direct = m_data;
+                }
+                break;
+            }
+        }
+        
+        bindTexture();
+        // rows of indices needn't be a multiple of 4 bytes
+        glPixelStorei(GL_UNPACK_ALIGNMENT, m_format == FORMAT_INDEXED ? 1 : 4);
+        if (buffered)
+        {
+            // packed pixels go as they are, the driver has nothing to expand or swizzle.
+            // The data comes from the bound buffer, so this returns right away
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, pixelFormat(), pixelType(), offset);
+            m_fences[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (direct)
+        {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, pixelFormat(), pixelType(), direct);
+        }
+        
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        
+        beginFrame(m_nextPbo);
+    }
+    
+    void Texture::readFromVRAM(void *out) const
     {
         bindTexture();
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, m_width, m_height, 0, GL_RGB, GL_UNSIGNED_BYTE, m_data);
+        glPixelStorei(GL_PACK_ALIGNMENT, m_format == FORMAT_INDEXED ? 1 : 4);
+        glGetTexImage(GL_TEXTURE_2D, 0, pixelFormat(), pixelType(), out);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
     }
 }
@@ -3,63 +3,72 @@
 
 #include <assert.h>
 #include "glad/glad.h"
+#include "Image.h"
 
 namespace core
 {
-    
-    class ImageBase
-    {
-    protected:
-        int m_width, m_height, m_colors;
-        GLubyte *m_data;
-        
-    public:
-        ImageBase();
-        virtual ~ImageBase() {}
-        virtual void dispose()=0;
-        
-        inline GLubyte& getData(int x, int y, int color)
-        {
-            return m_data[y*(m_width*m_colors) + x*m_colors + color];
-        }
-        inline int width() const
-        {
-            return m_width;
-        }
-        inline int height() const
-        {
-            return m_height;
-        }
-        inline int colors() const
-        {
-            return m_colors;
-        }
-        
-    };
-    
-    class Image : public ImageBase
-    {
-    public:
-        const static int RED = 0;
-        const static int GREEN = 1;
-        const static int BLUE = 2;
-        
-    public:
-        ~Image();
-        
-        void loadFromFile(const char *file);
-        void dispose();
-    };
     
     class Texture : public ImageBase
     {
+    public:
+        // frames go to the texture through a ring of pixel buffers: while the driver
+        // copies one the next frame is written into another
+        const static int PBO_COUNT = 3;
+        
+        // where the pixels returned by data() live
+        enum Storage
+        {
+            // in a heap array copied into the next pixel buffer on upload. Always works
+            STORAGE_HEAP,
+            // right in the ring's pixel buffers, mapped while they are drawn into and
+            // unmapped for the upload
+            STORAGE_MAPPED,
+            // right in the ring's pixel buffers, mapped once for good and coherent
+            // (ARB_buffer_storage), so an upload is just the texture update
+            STORAGE_PERSISTENT
+        };
+        
+        // what a pixel of data() is
+        enum Format
+        {
+            // packed 0xAARRGGBB, see Image.h
+            FORMAT_BGRA,
+            // a byte, index of a palette (GL_R8). data() is really indices() then
+            FORMAT_INDEXED
+        };
+    
     private:
-        const static int COLORS = 3;
         GLuint m_glTex;
-    public:
-        const static int RED = 0;
-        const static int GREEN = 1;
-        const static int BLUE = 2;
+        Storage m_storage;
+        Format m_format;
+        GLuint m_pbos[PBO_COUNT];
+        // set when an upload from the buffer is issued, waited for before reusing it
+        GLsync m_fences[PBO_COUNT];
+        int m_nextPbo;
+        // STORAGE_HEAP pixels
+        Pixel *m_heap;
+        // STORAGE_PERSISTENT: the whole ring, one buffer after another
+        unsigned char *m_persistent;
+        
+        // wait until the upload from buffer i is done
+        void waitForPbo(int i);
+        // point m_data at buffer i, mapping it if needed
+        void beginFrame(int i);
+        // draw into m_heap from now on, when the buffers can't be mapped
+        void useHeap();
+        // how data() goes to glTexSubImage2D
+        inline GLenum pixelFormat() const
+        {
+            return m_format == FORMAT_INDEXED ? GL_RED : GL_BGRA;
+        }
+        inline GLenum pixelType() const
+        {
+            return m_format == FORMAT_INDEXED ? GL_UNSIGNED_BYTE : GL_UNSIGNED_INT_8_8_8_8_REV;
+        }
+        inline size_t frameBytes() const
+        {
+            return (size_t)m_width * m_height * (m_format == FORMAT_INDEXED ? 1 : sizeof(Pixel));
+        }
         
     public:
         // initialize empty texture
@@ -68,25 +77,46 @@ namespace core
         ~Texture();
         void dispose();
         
-        // create OpenGL texture and fill it with black color
-        void createGlTexture(int width, int height);
+        // create OpenGL texture and fill it with black color. Its storage is allocated
+        // here, once, immutable where ARB_texture_storage is there. The pixels go to
+        // the best storage up to the preferred one the driver supports
+        void createGlTexture(int width, int height, Storage preferred = STORAGE_HEAP, Format format = FORMAT_BGRA);
         // fill local buffer with black color
         void clearTexture() const;
-        // load from local buffer to Video card RAM
-        void loadToVRAM() const;
+        // Load from local buffer to Video card RAM. The pixels are copied to the next
+        // buffer of the ring, or were drawn right into it, and the texture is updated
+        // from it without waiting for that to finish; the call only blocks if the
+        // driver is PBO_COUNT frames behind.
+        // Without STORAGE_HEAP data() points to new memory after this, with
+        // undefined contents: draw every pixel of every frame
+        void loadToVRAM();
+        // read the texture back, for checking uploads. out holds width*height pixels
+        // of the format
+        void readFromVRAM(void *out) const;
         
+        inline Storage storage() const
+        {
+            return m_storage;
+        }
+        inline Format format() const
+        {
+            return m_format;
+        }
+        // the pixels of a FORMAT_INDEXED texture
+        inline unsigned char* indices()
+        {
+            assert(m_format == FORMAT_INDEXED);
+            return (unsigned char*)m_data;
+        }
         // bind texture as current 2d texture
         inline void bindTexture() const
         {
             glBindTexture(GL_TEXTURE_2D, m_glTex);
         }
-        // get one byte from local buffer (read or write)
-        inline void setPixel(int x, int y, GLubyte r, GLubyte g, GLubyte b)
+        // write one pixel of local buffer
+        inline void setPixel(int x, int y, Pixel p)
         {
-            GLubyte *p_data = m_data + y*(m_width*COLORS) + x*COLORS;
-            *p_data = r;
-            *(++p_data) = g;
-            *(++p_data) = b;
+            m_data[y*m_width + x] = p;
         }
     };
 }
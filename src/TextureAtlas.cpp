@@ -0,0 +1,97 @@
+#include "TextureAtlas.h"
+
+#include <stdint.h>
+
+namespace core
+{
+    TextureAtlas::TextureAtlas(int tileSize, int capacity)
+    : m_tileShift(0),
+    m_capacity(capacity),
+    m_tiles(0)
+    {
+        assert(tileSize > 0 && (tileSize & (tileSize - 1)) == 0);
+        while ((1 << m_tileShift) < tileSize) ++m_tileShift;
+        size_t offset = 0;
+        for (int level = 0; level < levels(); ++level)
+        {
+            m_levelOffsets.push_back(offset);
+            offset += (size_t)1 << (2 * (m_tileShift - level));
+        }
+        // some spare pixels to move the start to an aligned address
+        const size_t spare = ALIGNMENT / sizeof(Pixel);
+        m_storage.assign(((size_t)capacity << (2 * m_tileShift + 1)) + spare, 0);
+        uintptr_t address = (uintptr_t)m_storage.data();
+        m_data = m_storage.data() + (ALIGNMENT - address % ALIGNMENT) % ALIGNMENT / sizeof(Pixel);
+    }
+    
+    void TextureAtlas::buildMipChain(int i)
+    {
+        Pixel *tile = tileData(i);
+        for (int level = 1; level < levels(); ++level)
+        {
+            int shift = m_tileShift - level;
+            const Pixel *from = tile + m_levelOffsets[level - 1];
+            Pixel *to = tile + m_levelOffsets[level];
+            for (int x = 0; x < 1 << shift; ++x)
+            {
+                for (int y = 0; y < 1 << shift; ++y)
+                {
+                    // the level above is twice the size, so its rows go up to shift + 1
+                    Pixel p[4] =
+                    {
+                        from[((2*x) << (shift + 1)) | (2*y)], from[((2*x) << (shift + 1)) | (2*y + 1)],
+                        from[((2*x + 1) << (shift + 1)) | (2*y)], from[((2*x + 1) << (shift + 1)) | (2*y + 1)]
+                    };
+                    to[(x << shift) | y] = packPixel((pixelRed(p[0]) + pixelRed(p[1]) + pixelRed(p[2]) + pixelRed(p[3]) + 2) / 4,
+                                                     (pixelGreen(p[0]) + pixelGreen(p[1]) + pixelGreen(p[2]) + pixelGreen(p[3]) + 2) / 4,
+                                                     (pixelBlue(p[0]) + pixelBlue(p[1]) + pixelBlue(p[2]) + pixelBlue(p[3]) + 2) / 4,
+                                                     (pixelAlpha(p[0]) + pixelAlpha(p[1]) + pixelAlpha(p[2]) + pixelAlpha(p[3]) + 2) / 4);
+                }
+            }
+        }
+    }
+    
+    int TextureAtlas::add(const Image &image)
+    {
+        assert(m_tiles < m_capacity);
+        assert(image.width() > 0 && image.height() > 0);
+        int i = m_tiles++;
+        int size = tileSize();
+        Pixel *tile = tileData(i);
+        for (int x = 0; x < size; ++x)
+        {
+            int imageX = x * image.width() / size;
+            for (int y = 0; y < size; ++y)
+            {
+                tile[(x << m_tileShift) | y] = image.pixel(imageX, y * image.height() / size);
+            }
+        }
+        buildMipChain(i);
+        return i;
+    }
+    
+    int TextureAtlas::addFromFile(const char *file)
+    {
+        Image image;
+        if (!image.loadFromFile(file)) return -1;
+        return add(image);
+    }
+    
+    int TextureAtlas::addTinted(int source, Pixel tint)
+    {
+        assert(m_tiles < m_capacity);
+        int i = m_tiles++;
+        const Pixel *from = tile(source);
+        Pixel *to = tileData(i);
+        for (size_t t = 0; t < (size_t)1 << (2 * m_tileShift); ++t)
+        {
+            Pixel p = from[t];
+            to[t] = packPixel(pixelRed(p) * pixelRed(tint) / 255,
+                              pixelGreen(p) * pixelGreen(tint) / 255,
+                              pixelBlue(p) * pixelBlue(tint) / 255,
+                              pixelAlpha(p));
+        }
+        buildMipChain(i);
+        return i;
+    }
+}
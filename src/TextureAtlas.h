@@ -0,0 +1,86 @@
+#ifndef TEXTURE_ATLAS_H
+#define TEXTURE_ATLAS_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <vector>
+
+#include "Image.h"
+
+namespace core
+{
+    // Square textures of one power of two size, decoded once and laid out one after
+    // another in a single aligned block. Every tile has its chain of mip levels, each
+    // half the size of the one before, down to a single texel: level 0 first, then
+    // the others back to back. A tile with its chain takes 2 * tileSize^2 texels, so
+    // tile i starts at i << (2*tileShift + 1). Levels are column-major, a wall column
+    // is a linear run, and texel (x, y) of a level of size 1 << shift is at
+    // (x << shift) | y from the start of the level
+    class TextureAtlas
+    {
+    public:
+        // tiles start at cache line boundaries
+        const static int ALIGNMENT = 64;
+    
+    private:
+        int m_tileShift;
+        int m_capacity, m_tiles;
+        // texels from the start of a tile to every level
+        std::vector<size_t> m_levelOffsets;
+        std::vector<Pixel> m_storage;
+        Pixel *m_data;
+        
+        inline Pixel* tileData(int i)
+        {
+            return m_data + ((size_t)i << (2 * m_tileShift + 1));
+        }
+        // fill the levels after 0 of tile i, every texel is the average of 2x2 above
+        void buildMipChain(int i);
+    
+    public:
+        // room for capacity tiles of tileSize x tileSize, a power of two
+        TextureAtlas(int tileSize, int capacity);
+        TextureAtlas(const TextureAtlas&) = delete;
+        
+        // copy the image into the next tile, make its mip chain and return its index.
+        // Images of another size are scaled to the tile with the nearest texel
+        int add(const Image &image);
+        // -1 when the file can't be loaded
+        int addFromFile(const char *file);
+        // copy of a tile with every channel multiplied by the one of tint
+        int addTinted(int tile, Pixel tint);
+        
+        inline int tileShift() const
+        {
+            return m_tileShift;
+        }
+        inline int tileSize() const
+        {
+            return 1 << m_tileShift;
+        }
+        inline int tileCount() const
+        {
+            return m_tiles;
+        }
+        // level l is 1 << (tileShift - l) texels squared
+        inline int levels() const
+        {
+            return m_tileShift + 1;
+        }
+        inline const Pixel* data() const
+        {
+            return m_data;
+        }
+        inline const Pixel* tile(int i, int level = 0) const
+        {
+            assert(0 <= i && i < m_tiles && 0 <= level && level < levels());
+            return m_data + ((size_t)i << (2 * m_tileShift + 1)) + m_levelOffsets[level];
+        }
+        inline const Pixel& texel(int i, int x, int y) const
+        {
+            return m_data[((size_t)i << (2 * m_tileShift + 1)) | (x << m_tileShift) | y];
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,132 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace core
+{
+    ThreadPool::ThreadPool(int threadCount)
+    : m_generation(0),
+    m_stop(false),
+    m_body(nullptr),
+    m_remaining(0)
+    {
+        if (threadCount <= 0)
+        {
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (int i = 0; i < threadCount; ++i)
+        {
+            m_queues.emplace_back(new Queue());
+        }
+        for (int i = 1; i < threadCount; ++i)
+        {
+            m_threads.emplace_back(&ThreadPool::workerLoop, this, i);
+        }
+    }
+    
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wakeCv.notify_all();
+        for (std::thread &thread : m_threads)
+        {
+            thread.join();
+        }
+    }
+    
+    void ThreadPool::parallelFor(int count, const std::function<void(int)> &body)
+    {
+        if (count <= 0) return;
+        if (m_threads.empty())
+        {
+            for (int i = 0; i < count; ++i) body(i);
+            return;
+        }
+        
+        m_body = &body;
+        m_remaining = count;
+        // neighbouring tasks usually touch neighbouring memory, so every queue gets
+        // a contiguous range instead of every n-th task
+        int queues = threadCount();
+        for (int q = 0; q < queues; ++q)
+        {
+            std::lock_guard<std::mutex> lock(m_queues[q]->mutex);
+            for (int i = q * count / queues; i < (q + 1) * count / queues; ++i)
+            {
+                m_queues[q]->tasks.push_back(i);
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_generation;
+        }
+        m_wakeCv.notify_all();
+        
+        runTasks(0);
+        
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_doneCv.wait(lock, [this] { return m_remaining == 0; });
+        m_body = nullptr;
+    }
+    
+    void ThreadPool::workerLoop(int index)
+    {
+        unsigned seen = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wakeCv.wait(lock, [this, seen] { return m_stop || m_generation != seen; });
+                if (m_stop) return;
+                seen = m_generation;
+            }
+            runTasks(index);
+        }
+    }
+    
+    void ThreadPool::runTasks(int index)
+    {
+        int task;
+        while (popTask(index, task))
+        {
+            (*m_body)(task);
+            if (--m_remaining == 0)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_doneCv.notify_one();
+            }
+        }
+    }
+    
+    bool ThreadPool::popTask(int index, int &task)
+    {
+        // own queue first, from the front
+        {
+            Queue &own = *m_queues[index];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty())
+            {
+                task = own.tasks.front();
+                own.tasks.pop_front();
+                return true;
+            }
+        }
+        // steal from the back of someone else's
+        int queues = threadCount();
+        for (int i = 1; i < queues; ++i)
+        {
+            Queue &victim = *m_queues[(index + i) % queues];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty())
+            {
+                task = victim.tasks.back();
+                victim.tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace core
+{
+    // Worker threads that live as long as the pool, so a frame doesn't pay for
+    // creating them. Every worker has its own queue of tasks and takes them from the
+    // front; a worker with an empty queue steals from the back of the others'
+    class ThreadPool
+    {
+    private:
+        struct Queue
+        {
+            std::mutex mutex;
+            std::deque<int> tasks;
+        };
+        
+        std::vector<std::thread> m_threads;
+        // queue 0 belongs to the thread that calls parallelFor()
+        std::vector<std::unique_ptr<Queue>> m_queues;
+        
+        std::mutex m_mutex;
+        std::condition_variable m_wakeCv, m_doneCv;
+        unsigned m_generation;
+        bool m_stop;
+        
+        const std::function<void(int)> *m_body;
+        std::atomic<int> m_remaining;
+    
+    public:
+        // threadCount includes the calling thread. 0 means one per hardware thread
+        explicit ThreadPool(int threadCount = 0);
+        ThreadPool(const ThreadPool&) = delete;
+        ~ThreadPool();
+        
+        inline int threadCount() const
+        {
+            return (int)m_queues.size();
+        }
+        
+        // call body(i) for every i in [0; count) and return when all calls are done.
+        // The calling thread works too. Not reentrant
+        void parallelFor(int count, const std::function<void(int)> &body);
+    
+    private:
+        void workerLoop(int index);
+        // run tasks until there are none left in any queue
+        void runTasks(int index);
+        bool popTask(int index, int &task);
+    };
+}
+
+#endif
@@ -37,6 +37,12 @@ namespace core
         glfwPollEvents();
     }
     
+    void Window::setSwapInterval(int interval)
+    {
+        glfwMakeContextCurrent(m_window);
+        glfwSwapInterval(interval);
+    }
+    
     void Window::dispose()
     {
         if (m_window)
@@ -17,6 +17,8 @@ namespace core
         
         void createGlContext(int width, int height);
         void update();
+        // screen refreshes a swap waits for: 1 is vsync, 0 doesn't wait
+        void setSwapInterval(int interval);
         void dispose();
         inline int mustClose() { return glfwWindowShouldClose(m_window); }
         inline int getKeyState(int key) { return glfwGetKey(m_window, key); }
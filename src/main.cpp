@@ -1,8 +1,10 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 #include <ctype.h>
-#include <thread>
+#include <stdlib.h>
+#include <string.h>
 #include <chrono>
+#include <vector>
 
 #include "glad/glad.h"
 #include "GLFW/glfw3.h"
@@ -11,9 +13,16 @@
 
 #include "learnopengl/shader.h"
 #include "RaycasterEngine.h"
+#include "RaycasterSimd.h"
+#include "MapFile.h"
+#include "ChunkStreamer.h"
 #include "Window.h"
+#include "HeadlessContext.h"
 #include "Texture.h"
+#include "TextureAtlas.h"
 #include "ImageRenderer.h"
+#include "FrameScheduler.h"
+#include "GpuRenderer.h"
 
 const int WIDTH = 1024;
 const int HEIGHT = 768;
@@ -21,10 +30,20 @@ auto console = spdlog::stdout_color_st("console");
 
 const char *VERTEX_SHADER = "resources/shader.vert";
 const char *FRAGMENT_SHADER = "resources/shader.frag";
+const char *RAYCAST_SHADER = "resources/raycast.frag";
 const int TEX1_WIDTH = 320;
 const int TEX1_HEIGHT = 280;
+// wall textures are scaled to this size in the atlas
+const int WALL_TEXTURE_SIZE = 64;
+const int WALL_MATERIALS = 9;
 const int BOARD_WIDTH = 16;
 const int BOARD_HEIGHT = 16;
+// threads rendering the frame, 0 - one per hardware thread
+const int RENDER_THREADS = 0;
+// frames drawn by a --headless run, turning around on the spot
+const int HEADLESS_FRAMES = 120;
+// memory for map chunks when a map is streamed
+const size_t STREAM_BUDGET = 64 << 20;
 
 
 void glfwErrorCallback(int error, const char *desc)
@@ -85,7 +104,12 @@ public:
         return wrapAngle(angle + fov / 2.f);
     }
     
-    void update(float dt, core::Window& window, bool board[][BOARD_WIDTH])
+    raycaster::Camera camera() const
+    {
+        return raycaster::Camera(pos, angle, fov);
+    }
+    
+    void update(float dt, core::Window& window, const raycaster::Map &map)
     {
         // rotations
         if (window.getKeyState(GLFW_KEY_LEFT) == GLFW_PRESS)
@@ -104,7 +128,9 @@ public:
             float moveFactor = (window.getKeyState(GLFW_KEY_DOWN)|window.getKeyState(GLFW_KEY_S) == GLFW_PRESS ? -dt : dt) * 3.0f;
             moveForward(moveFactor);
             
-            if (board[(int)pos.y][(int)pos.x])
+            // the cell the rays see the camera in: a cast would put -0.5 in cell 0,
+            // not in the wall outside the map
+            if (map.isWall((int)floorf(pos.x), (int)floorf(pos.y)))
             {
                 pos = previous;
             }
@@ -116,7 +142,7 @@ public:
             float moveFactor = (window.getKeyState(GLFW_KEY_A) == GLFW_PRESS ? -dt : dt) * 3.0f;
             strafeRight(moveFactor);
             
-            if (board[(int)pos.y][(int)pos.x])
+            if (map.isWall((int)floorf(pos.x), (int)floorf(pos.y)))
             {
                 pos = previous;
             }
@@ -133,187 +159,259 @@ T clamp(T a, T b, T value)
 }
 using raycaster::vec2;
 
-int main()
+int main(int argc, char **argv)
 {
     console->set_level(spdlog::level::debug);
     
-    glfwInit();
-    glfwSetErrorCallback(glfwErrorCallback);
+    const char *USAGE = "[map file] [--stream] [--headless] [--gpu] [--indexed] [--uncapped | --fps N]";
+    const char *mapFile = nullptr;
+    bool stream = false, headless = false, gpu = false, indexed = false;
+    core::FrameScheduler::Pacing pacing = core::FrameScheduler::PACING_VSYNC;
+    double targetFps = 60.;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--stream") == 0) stream = true;
+        else if (strcmp(argv[i], "--headless") == 0) headless = true;
+        else if (strcmp(argv[i], "--gpu") == 0) gpu = true;
+        else if (strcmp(argv[i], "--indexed") == 0) indexed = true;
+        else if (strcmp(argv[i], "--uncapped") == 0) pacing = core::FrameScheduler::PACING_UNCAPPED;
+        else if (strcmp(argv[i], "--fps") == 0)
+        {
+            // the value is always taken, so a bad one can't pass for the map file
+            const char *value = i + 1 < argc ? argv[++i] : "";
+            char *end;
+            targetFps = strtod(value, &end);
+            if (end == value || *end != '\0' || !(targetFps > 0. && targetFps < HUGE_VAL))
+            {
+                console->error("--fps needs a positive number of frames per second, not \"{0}\"", value);
+                console->info("Usage: {0} {1}", argv[0], USAGE);
+                return 1;
+            }
+            pacing = core::FrameScheduler::PACING_TARGET_FPS;
+        }
+        else if (strncmp(argv[i], "--", 2) == 0)
+        {
+            console->error("Unknown option {0}", argv[i]);
+            console->info("Usage: {0} {1}", argv[0], USAGE);
+            return 1;
+        }
+        else mapFile = argv[i];
+    }
     
-    // init
+    // init. A headless run has no window, it draws some frames and checks that the
+    // last one got into the texture intact. With --gpu the rays are cast by a shader,
+    // a headless run checks every frame of it against the CPU renderer. With
+    // --indexed the CPU draws palette indices, a byte per pixel (not with --gpu)
+    indexed = indexed && !gpu;
     core::Window window;
-    window.createGlContext(WIDTH, HEIGHT);
+    core::HeadlessContext headlessContext;
+    if (headless)
+    {
+        if (!headlessContext.create()) return 1;
+    }
+    else
+    {
+        glfwInit();
+        glfwSetErrorCallback(glfwErrorCallback);
+        window.createGlContext(WIDTH, HEIGHT);
+    }
     
     Shader shader(VERTEX_SHADER, FRAGMENT_SHADER);
     shader.use();
+    shader.setInt("ourTexture", 0);
+    shader.setInt("palette", 1);
+    shader.setBool("indexed", indexed);
     
     // tex1 doesn't have to be a pointer, just a legacy I'm too lasy to get rid of
     core::Texture *tex1 = new core::Texture();
-    tex1->createGlTexture(TEX1_WIDTH, TEX1_HEIGHT);
-    core::Image brickTexture;
-    brickTexture.loadFromFile("resources/brick.png");
+    tex1->createGlTexture(TEX1_WIDTH, TEX1_HEIGHT, core::Texture::STORAGE_PERSISTENT,
+                          indexed ? core::Texture::FORMAT_INDEXED : core::Texture::FORMAT_BGRA);
+    const char *STORAGE_NAMES[] = { "heap", "mapped pixel buffers", "persistently mapped pixel buffers" };
+    console->info("Frames are drawn into {0}", STORAGE_NAMES[tex1->storage()]);
+    // there is one wall texture so far, materials 2..9 are tinted copies of it
+    core::TextureAtlas wallTextures(WALL_TEXTURE_SIZE, WALL_MATERIALS);
+    int brick = wallTextures.addFromFile("resources/brick.png");
+    if (brick < 0) return 1;
+    const core::Pixel TINTS[WALL_MATERIALS - 1] =
+    {
+        core::packPixel(0xff, 0x80, 0x80), core::packPixel(0x80, 0xff, 0x80),
+        core::packPixel(0x80, 0x80, 0xff), core::packPixel(0xff, 0xff, 0x80),
+        core::packPixel(0x80, 0xff, 0xff), core::packPixel(0xff, 0x80, 0xff),
+        core::packPixel(0xc0, 0xc0, 0xc0), core::packPixel(0x80, 0x80, 0x80)
+    };
     core::ImageRenderer renderer;
+    raycaster::Renderer raycaster;
+    raycaster.setWallTextures(&wallTextures);
+    int materialTiles[WALL_MATERIALS + 1] = { 0, brick };
+    for (int material = 2; material <= WALL_MATERIALS; ++material)
+    {
+        materialTiles[material] = wallTextures.addTinted(brick, TINTS[material - 2]);
+    }
+    for (int material = 1; material <= WALL_MATERIALS; ++material)
+    {
+        raycaster.setMaterialTexture(material, materialTiles[material]);
+    }
+    raycaster.setThreadCount(RENDER_THREADS);
+    // a mapped buffer may be write-combined memory that is slow to write column by
+    // column, the transpose writes it row by row
+    raycaster.setColumnMajor(tex1->storage() != core::Texture::STORAGE_HEAP);
+    console->info("Ray kernel: {0}, render threads: {1}", raycaster::rayKernelName(raycaster.rayKernel()), raycaster.threadCount());
+    // the colors of the indices sit in texture unit 1 for the whole run
+    core::Texture paletteTexture;
+    if (indexed)
+    {
+        raycaster.buildPalette();
+        paletteTexture.createGlTexture(core::Palette::SIZE, 1);
+        std::copy(raycaster.palette().colors(), raycaster.palette().colors() + core::Palette::SIZE, paletteTexture.data());
+        paletteTexture.loadToVRAM();
+        glActiveTexture(GL_TEXTURE1);
+        paletteTexture.bindTexture();
+        glActiveTexture(GL_TEXTURE0);
+    }
     
-    bool board[BOARD_HEIGHT][BOARD_WIDTH] =
+    // material of every cell, 0 is empty
+    unsigned char board[BOARD_HEIGHT][BOARD_WIDTH] =
     {
         { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 },
         { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
         { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
-        { 1, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
-        { 1, 0, 0, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
-        { 1, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+        { 1, 0, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+        { 1, 0, 0, 2, 2, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+        { 1, 0, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
         { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
-        { 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
-        { 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1 },
+        { 1, 0, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+        { 1, 0, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 4, 0, 0, 1 },
         { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
         { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
-        { 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 1 },
-        { 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 1 },
-        { 1, 0, 0, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+        { 1, 0, 0, 6, 0, 0, 0, 0, 0, 0, 0, 0, 5, 5, 0, 1 },
+        { 1, 0, 0, 6, 0, 0, 0, 0, 0, 0, 0, 0, 5, 5, 0, 1 },
+        { 1, 0, 0, 6, 6, 6, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
         { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
         { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 },
     };
+    // a map file made by MapConverter if one is given, the board otherwise. With
+    // --stream only the chunks around the player are kept in memory
+    raycaster::ChunkStreamer streamer(STREAM_BUDGET);
+    std::unique_ptr<raycaster::Map> loaded;
+    raycaster::Map *map = nullptr;
+    if (mapFile && stream)
+    {
+        if (streamer.open(mapFile)) map = &streamer.map();
+    }
+    else if (mapFile)
+    {
+        loaded = raycaster::MapFile::load(mapFile);
+        map = loaded.get();
+    }
+    if (!map)
+    {
+        loaded.reset(new raycaster::Map(BOARD_WIDTH, BOARD_HEIGHT));
+        map = loaded.get();
+        for (int i = 0; i < BOARD_HEIGHT; ++i)
+        {
+            for (int j = 0; j < BOARD_WIDTH; ++j)
+            {
+                map->setCell(j, i, board[i][j]);
+            }
+        }
+    }
     
-    
-    // Game Loop
-    double start = glfwGetTime();
-    Player p(BOARD_WIDTH/2+0.1f, BOARD_HEIGHT/2+0.1f, 0.f, glm::radians(45.f));
-    while (!window.mustClose())
+    // the shader backend sees the same textures as the CPU one and a copy of the map
+    std::unique_ptr<raycaster::GpuRenderer> gpuRenderer;
+    if (gpu)
     {
-        double end = glfwGetTime();
-        double dt = end - start;
-        start = end;
-        // make processor sleep if we are getting our job done in time
-        if (dt < (1. / 60.))
+        gpuRenderer.reset(new raycaster::GpuRenderer(VERTEX_SHADER, RAYCAST_SHADER));
+        gpuRenderer->setWallTextures(wallTextures);
+        for (int material = 1; material <= WALL_MATERIALS; ++material)
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds((1000 / 60 - (int)dt*1000)));
+            gpuRenderer->setMaterialTexture(material, materialTiles[material]);
         }
+        // if the map doesn't fit on the GPU the CPU draws after all
+        gpu = gpuRenderer->uploadMap(*map);
+        console->info("Rays are cast by the {0}", gpu ? "GPU" : "CPU");
+    }
+    
+    
+    // Game Loop. Vsync by default: the swap paces the frames. A headless run has
+    // nothing to wait for
+    core::FrameScheduler scheduler(headless ? core::FrameScheduler::PACING_UNCAPPED : pacing, targetFps);
+    if (!headless)
+    {
+        window.setSwapInterval(scheduler.swapInterval());
+    }
+    Player p(map->width()/2+0.1f, map->height()/2+0.1f, 0.f, glm::radians(45.f));
+    int frameCount = 0;
+    // bytes of the last frame
+    std::vector<unsigned char> expected;
+    size_t frameBytes = tex1->width() * tex1->height() * (indexed ? 1 : sizeof(core::Pixel));
+    // --gpu --headless: frames of the shader and their pixels that differ from the CPU's
+    std::vector<core::Pixel> gpuPixels(gpu ? tex1->width() * tex1->height() : 0);
+    uint64_t gpuWrong = 0;
+    while (headless ? frameCount < HEADLESS_FRAMES : !window.mustClose())
+    {
+        double dt = scheduler.beginFrame();
         
         // input processing ...
-        p.update(dt, window, board);
-        
-        // update texture here ...
-        tex1->clearTexture();
-        // raycast here!
-        const float MAX_DIST = 16.f;
-        for (int x = 0; x < tex1->width(); ++x)
+        if (headless)
         {
-            // [-pov/2; +pov/2]
-            float rayDisplacementAngle = -p.fov / 2.f + (1.f * x / tex1->width()) * p.fov;
-            float rayAngle = p.angle + rayDisplacementAngle;
-            
-            float wallDist = 0.f;
-            bool wallHit = false;
-            vec2<float> uvTextureSample(0.f, 0.f);
-            // to create "shadow" effect we divide final color by this value
-            int side = 1;
-            
-            vec2<int> curBrick(floorf(p.pos.x), floorf(p.pos.y));
-            vec2<int> brickStep = raycaster::getDeltaBrick(rayAngle);
-            vec2<float> hitCoord = p.pos;
-            vec2<float> initDelta = vec2<float>(raycaster::modSgn(brickStep.x), raycaster::modSgn(brickStep.y)) + vec2<float>(curBrick) - p.pos;
-            
-            float tanRayAngle = fabsf(tanf(rayAngle));
-            float dx = brickStep.x * 1.f / tanRayAngle;
-            float dy = brickStep.y * tanRayAngle;
-            
-            vec2<float> advanceX = hitCoord + vec2<float>(initDelta.x, brickStep.y * fabsf(initDelta.x * tanRayAngle));
-            vec2<float> advanceY = hitCoord + vec2<float>(brickStep.x * fabsf(initDelta.y / tanRayAngle), initDelta.y);
-            
-            while (!wallHit)
+            p.rotate(2.f * (float)M_PI / HEADLESS_FRAMES);
+        }
+        else
+        {
+            p.update(dt, window, *map);
+        }
+        if (streamer.isOpen())
+        {
+            streamer.update(p.camera());
+            // the shader's copy of the map follows the chunks streamed in and out
+            if (gpu)
             {
-                if (board[curBrick.y][curBrick.x] || (hitCoord-p.pos).sqrLen() >= MAX_DIST*MAX_DIST)
+                for (size_t chunk : streamer.changedChunks())
                 {
-                    wallHit = true;
-                    wallDist = std::min(MAX_DIST, (hitCoord-p.pos).len());
-                    
-                    // calculating texture sampling u coordinate
-                    vec2<float> wallCenter = vec2<float>(curBrick.x+0.5f, curBrick.y+0.5f);
-                    vec2<float> dirFromCenter = hitCoord - wallCenter;
-                    float angle = atan2(dirFromCenter.y, dirFromCenter.x);
-                    int octant = raycaster::getOctant((double)angle);
-                    
-                    if (octant==4||octant==5)
-                    {
-                        uvTextureSample.x = raycaster::getFraction(hitCoord.y);
-                        side = 1;
-                    }
-                    if(octant==8||octant==1)
-                    {
-                        uvTextureSample.x = 1.0f-raycaster::getFraction(hitCoord.y);
-                        side = 1;
-                    }
-                    if (octant==6||octant==7)
-                    {
-                        uvTextureSample.x = 1.0f-raycaster::getFraction(hitCoord.x);
-                        side = 2;
-                    }
-                    if (octant==2||octant==3)
-                    {
-                        uvTextureSample.x = raycaster::getFraction(hitCoord.x);
-                        side = 2;
-                    }
-                }
-                else
-                {
-                    // find intersection with the closest cell
-                    
-                    // if x advanced less then y
-                    if ((advanceX - p.pos).sqrLen() < (advanceY - p.pos).sqrLen())
-                    {
-                        // move in X
-                        hitCoord = advanceX;
-                        advanceX += vec2<float>(brickStep.x, dy);
-                        curBrick.x += brickStep.x;
-                    }
-                    else
-                    {
-                        // move in Y
-                        hitCoord = advanceY;
-                        advanceY += vec2<float>(dx, brickStep.y);
-                        curBrick.y += brickStep.y;
-                    }
+                    gpuRenderer->updateMapChunk(*map, chunk);
                 }
             }
-            
-            // z is a distance to a wall
-            // this line prevents the Fisheye Effect
-            float z = wallDist * cosf(rayDisplacementAngle);
-            int floorYBorder = tex1->height() / 2.f - tex1->height() / z;
-            int ceilingYBorder = tex1->height() - floorYBorder;
-            
-            // white near us, black when far
-            float colorMult = 1.0 * (1 - z / MAX_DIST);
-            
-            // paint the texture
-            // TODO do it in shader one day
-            for (int y = 0; y < tex1->height(); ++y)
+        }
+        
+        if (gpu && !headless)
+        {
+            // the whole frame is one quad
+            gpuRenderer->render(p.camera(), TEX1_WIDTH, TEX1_HEIGHT, renderer);
+            ++frameCount;
+            window.update();
+            continue;
+        }
+        
+        // raycast here! Every pixel of the frame is overwritten, no need to clear it
+        if (indexed)
+        {
+            raycaster::IndexedFrameBuffer frame(tex1->indices(), tex1->width(), tex1->height());
+            raycaster.renderFrame(p.camera(), *map, frame);
+        }
+        else
+        {
+            raycaster::FrameBuffer frame(tex1->data(), tex1->width(), tex1->height());
+            raycaster.renderFrame(p.camera(), *map, frame);
+        }
+        if (gpu)
+        {
+            raycaster::FrameBuffer gpuFrame(gpuPixels.data(), tex1->width(), tex1->height());
+            gpuRenderer->renderOffscreen(p.camera(), renderer, gpuFrame);
+            for (size_t i = 0; i < gpuPixels.size(); ++i)
             {
-                // floor
-                if (y <= floorYBorder) {
-                    tex1->setPixel(x, y, 0x55, 0x55, 0x55);
-                }
-                // wall
-                else if (y < ceilingYBorder)
-                {
-                    uvTextureSample.y = ((float)y - floorYBorder) / (ceilingYBorder - floorYBorder);
-                    vec2<int> coord = uvTextureSample.multPerCoord(vec2<float>(brickTexture.width(), brickTexture.height()));
-                    tex1->setPixel(x, y,
-                                   colorMult*brickTexture.getData(coord.x, coord.y, 0)/side,
-                                   colorMult*brickTexture.getData(coord.x, coord.y, 1)/side,
-                                   colorMult*brickTexture.getData(coord.x, coord.y, 2)/side
-                                   );
-                }
-                // ceiling
-                else
-                {
-                    tex1->setPixel(x, y, 0x55, 0x55, 0xff);
-                }
+                gpuWrong += gpuPixels[i] != tex1->data()[i];
             }
-            
+        }
+        if (headless && frameCount == HEADLESS_FRAMES - 1)
+        {
+            // data() moves on to the next buffer with the upload, keep what was drawn
+            expected.assign((unsigned char*)tex1->data(), (unsigned char*)tex1->data() + frameBytes);
         }
         tex1->loadToVRAM();
         
+        ++frameCount;
+        if (headless) continue;
+        
         // rendering texture ...
         renderer.render(tex1, &shader);
         
@@ -321,11 +419,48 @@ int main()
         window.update();
     }
     
-    brickTexture.dispose();
+    int status = 0;
+    if (headless)
+    {
+        std::vector<unsigned char> uploaded(frameBytes);
+        tex1->readFromVRAM(uploaded.data());
+        int wrong = 0;
+        for (size_t i = 0; i < uploaded.size(); ++i)
+        {
+            wrong += uploaded[i] != expected[i];
+        }
+        console->info("Headless: {0} frames, {1} bytes of the last one differ in the texture", frameCount, wrong);
+        status = wrong ? 1 : 0;
+        if (gpu)
+        {
+            console->info("Headless: {0} pixels of the shader's frames differ from the CPU's", gpuWrong);
+            status |= gpuWrong ? 1 : 0;
+        }
+    }
+    
+    core::FrameStats frameStats = scheduler.stats();
+    console->info("Frame times over the last {0} frames: {1:.2f} ms average, {2:.2f} p50, {3:.2f} p95, {4:.2f} p99, {5:.2f} worst",
+                  frameStats.frames, frameStats.average, frameStats.p50, frameStats.p95, frameStats.p99, frameStats.worst);
+    
+    if (streamer.isOpen())
+    {
+        const raycaster::StreamStats &stats = streamer.stats();
+        console->info("Streaming: {0} hits, {1} misses, {2} loads, {3} evictions, latency {4:.1f} ms average, {5:.1f} ms max",
+                      stats.hits, stats.misses, stats.loads, stats.evictions, stats.averageLatency, stats.maxLatency);
+    }
+    
+    if (gpuRenderer)
+    {
+        gpuRenderer->dispose();
+    }
     tex1->dispose();
+    paletteTexture.dispose();
     renderer.dispose();
     window.dispose();
-    glfwTerminate();
+    if (!headless)
+    {
+        glfwTerminate();
+    }
     
-    return 0;
+    return status;
 }